@@ -0,0 +1,153 @@
+#!/bin/sh
+#
+# Builds calculate_folder_size.c and parallel_merge_sort.c with their statistics compiled in, runs the
+# folder walker on a generated tree and the sort on several array sizes and algorithms, and appends one
+# JSON object per run to a JSON lines file. Every record carries the commit, host and thread count, so
+# runs of different versions can be compared, e.g. with jq.
+#
+# The tree has FANOUT sub-folders per folder, DEPTH levels below the top and FILES files per folder (of
+# 0 to 4095 bytes). It is generated once per shape in the work directory and kept for later runs. Only
+# the first walk of a run finds the tree outside the page cache, if at all.
+#
+# With -l, the tree is also walked under a low open-file limit (ulimit -n), where most sub-folders find no
+# descriptor and are opened later; the script fails if such a walk reports errors or another size.
+
+set -eu
+
+usage() {
+    cat <<EOF
+Usage: $0 [options]
+  -f FANOUT   sub-folders per folder (default 8)
+  -d DEPTH    levels of sub-folders below the top (default 3)
+  -n FILES    files per folder (default 100)
+  -s SIZES    array sizes for the sort, separated by commas (default 1000000,10000000)
+  -a ALGS     sort algorithms (auto, merge, radix, sample), separated by commas (default auto,merge)
+  -t THREADS  thread counts, separated by commas (default: the number of CPUs)
+  -r RUNS     repetitions of every measurement (default 3)
+  -u          also walk the tree with --uring
+  -l NOFILE   also walk the tree under ulimit -n NOFILE (e.g. 24), and fail on errors or another size
+  -w DIR      work directory for the binaries and trees (default ./benchmark)
+  -o FILE     JSON lines file to append to (default ./benchmark.jsonl)
+The compiler and its flags are taken from CC (default gcc) and CFLAGS (default -O2).
+EOF
+    exit 1
+}
+
+fanout=8
+depth=3
+files=100
+sizes=1000000,10000000
+algorithms=auto,merge
+threads=$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1)
+runs=3
+uring=0
+nofile=
+work=./benchmark
+out=./benchmark.jsonl
+
+while getopts f:d:n:s:a:t:r:ul:w:o: opt; do
+    case $opt in
+        f) fanout=$OPTARG ;;
+        d) depth=$OPTARG ;;
+        n) files=$OPTARG ;;
+        s) sizes=$OPTARG ;;
+        a) algorithms=$OPTARG ;;
+        t) threads=$OPTARG ;;
+        r) runs=$OPTARG ;;
+        u) uring=1 ;;
+        l) nofile=$OPTARG ;;
+        w) work=$OPTARG ;;
+        o) out=$OPTARG ;;
+        *) usage ;;
+    esac
+done
+[ $OPTIND -gt $# ] || usage
+
+src=$(cd "$(dirname "$0")" && pwd)
+cc=${CC:-gcc}
+cflags=${CFLAGS:--O2}
+mkdir -p "$work"
+
+# Build
+$cc $cflags -fopenmp -DFOLDER_SIZE_STATS "$src/calculate_folder_size.c" -o "$work/calculate_folder_size"
+$cc $cflags -fopenmp -DMERGE_SORT_STATS "$src/parallel_merge_sort.c" -o "$work/parallel_merge_sort" -lm
+
+# Generate the tree: every folder gets its files in one awk call, then its sub-folders
+tree=$work/tree-f$fanout-d$depth-n$files
+make_folder() ( # make_folder folder levels_left, in a subshell for its own i
+    mkdir -p "$1"
+    awk -v dir="$1" -v n="$files" 'BEGIN {
+        for (i = 0; i < n; i++) {
+            f = dir "/f" i
+            printf "%" (i * 2654435761 % 4096) "s", "" > f
+            close(f)
+        }
+    }' </dev/null
+    if [ "$2" -gt 0 ]; then
+        i=0
+        while [ $i -lt "$fanout" ]; do
+            make_folder "$1/d$i" $(($2 - 1))
+            i=$((i + 1))
+        done
+    fi
+)
+if [ ! -d "$tree" ]; then
+    echo "generating $tree" >&2
+    make_folder "$tree.tmp" "$depth"
+    mv "$tree.tmp" "$tree"
+fi
+
+commit=$(git -C "$src" rev-parse --short HEAD 2>/dev/null || echo unknown)
+date=$(date -u +%Y-%m-%dT%H:%M:%SZ)
+host=$(uname -n)
+header="\"date\": \"$date\", \"commit\": \"$commit\", \"host\": \"$host\""
+
+# record program threads "other fields" stats_json
+record() {
+    printf '{%s, "program": "%s", "threads": %s, %s, "stats": %s}\n' "$header" "$1" "$2" "$3" "$4" >>"$out"
+}
+
+for t in $(echo "$threads" | tr , ' '); do
+    modes=default
+    [ $uring -eq 0 ] || modes="$modes uring"
+    [ -z "$nofile" ] || modes="$modes nofile"
+    [ -z "$nofile" ] || [ $uring -eq 0 ] || modes="$modes nofile-uring"
+    for mode in $modes; do
+        flag=
+        limit=
+        case $mode in *uring) flag=--uring ;; esac
+        case $mode in nofile*) limit=$nofile ;; esac
+        run=1
+        while [ $run -le "$runs" ]; do
+            # The statistics are the last line on stderr, the size is on stdout
+            stats=$( ([ -z "$limit" ] || ulimit -n "$limit"
+                      OMP_NUM_THREADS=$t "$work/calculate_folder_size" $flag --stats=json "$tree" \
+                          2>&1 >"$work/walk.out") | tail -n 1)
+            size=$(sed -n 's/^Size: \([0-9]*\).*/\1/p' "$work/walk.out")
+            record calculate_folder_size "$t" "\"mode\": \"$mode\", \"fanout\": $fanout, \"depth\": $depth, \"files\": $files, \"run\": $run" "$stats"
+            if [ "$mode" = default ]; then
+                tree_size=$size
+            elif [ "$size" != "$tree_size" ] || ! echo "$stats" | grep -q '"errors": 0,'; then
+                echo "walk with $t threads ($mode) found $size bytes instead of $tree_size: $stats" >&2
+                exit 1
+            fi
+            run=$((run + 1))
+        done
+        echo "walked $tree with $t threads ($mode)" >&2
+    done
+
+    for n in $(echo "$sizes" | tr , ' '); do
+        # auto picks the radix sort from 64K keys, so the merge sort's leaves and levels only show up
+        # with merge
+        for alg in $(echo "$algorithms" | tr , ' '); do
+            run=1
+            while [ $run -le "$runs" ]; do
+                stats=$("$work/parallel_merge_sort" -t "$t" -a "$alg" --stats=json "$n" | tail -n 1)
+                record parallel_merge_sort "$t" "\"n\": $n, \"algorithm\": \"$alg\", \"run\": $run" "$stats"
+                run=$((run + 1))
+            done
+            echo "sorted $n keys with $t threads ($alg)" >&2
+        done
+    done
+done
+echo "results appended to $out" >&2
@@ -1,83 +1,2082 @@
 // Program that recursively calculates a folder size (with all sub-folders) using OpenMP and Tasks.
 
+#define _GNU_SOURCE // statx()
 
 #include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
 #include <omp.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <time.h>
+#include <unistd.h>
 
-int calculate_folder_size(const char *path) {
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+
+// The first getdents64() call of a folder reads into a small buffer. Only if that comes back at least half full
+// (a large folder), the rest is read into the large one, so small folders don't pay for a big allocation.
+#define GETDENTS_SMALL_BUFFER (16 * 1024)
+#define GETDENTS_LARGE_BUFFER (512 * 1024)
+
+// Entries of a large folder are stat'ed by tasks of this many entries each
+#define STAT_CHUNK 512
+
+// d_type of a record in our own getdents64() buffer that came as DT_UNKNOWN and has been stat'ed and counted
+// since. The kernel never returns it.
+#define DT_COUNTED 0xff
+
+// Record of getdents64(), as defined by the kernel
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Depth of the io_uring of every thread. All stat requests of a chunk (a whole batch, if it is small) are in
+// flight at once, and the sub-folders of a batch are opened URING_OPEN_BATCH at a time.
+#define URING_ENTRIES STAT_CHUNK
+#define URING_OPEN_BATCH 64
+
+// io_uring of one thread, set up the first time the thread needs it
+struct uring {
+    int fd; // -1 if not set up yet, -2 if that failed (the thread then uses fstatat() and openat())
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    struct statx *stx; // result buffer of the i-th request of a statx batch
+    int *res;          // result of the i-th request of a batch
+};
+
+// Set with --uring: stat and open through io_uring, so many requests are waiting at once on slow file systems
+static int use_uring = 0;
+
+// Every thread has its own ring. The tasks are tied, and no task scheduling point lies between submitting a
+// batch and reaping it, so a ring is never used by two tasks at once.
+static struct uring ring = {.fd = -1};
+#pragma omp threadprivate(ring)
+#endif
+
+// Bytes of a file, or of a folder with everything in it
+struct usage {
+    uint64_t apparent;  // sum of st_size
+    uint64_t allocated; // sum of st_blocks * 512, the space taken on the disk
+};
+
+// Sums of the sizes found by all tasks of one traversal. Every task adds to its own copies (in_reduction),
+// and the copies are only added up when the taskgroup in calculate_folder_size() ends.
+static uint64_t folder_apparent_total;
+static uint64_t folder_allocated_total;
+
+// Set with --count-links: a file with several hard links counts once per link, not only for the first one found
+static int count_links = 0;
+
+// Descriptors of folders that are open: the top folder's, and those of the sub-folder tasks that have been created
+// and not finished yet, each holds its sub-folder's descriptor. Only changed with pending_lock held.
+static int open_folders = 0;
+
+// Limit of open_folders (--max-open). A sub-folder found beyond it is not opened, but put on pending_folders.
+static int max_open_folders = 0;
+
+// Sub-folder tasks that have been queued and not finished yet
+static int queued_tasks = 0;
+
+// Limit of queued_tasks (--max-tasks), beyond which a sub-folder is scanned by the task finding it, depth-first
+static int max_queued_tasks = 0;
+
+// Descriptors of RLIMIT_NOFILE left for everything but the folders and rings: stdin, stdout, stderr, the cache file
+// and the inotify descriptor
+#define OTHER_DESCRIPTORS 8
+
+// Sub-folders found while max_open_folders descriptors were open, linked by next_pending. They hold no descriptor.
+// Whoever finds one holds a descriptor itself, and every folder that gives its descriptor back opens pending
+// sub-folders by their path for as long as there are descriptors for them, so none is left behind.
+static struct folder *pending_folders = NULL;
+static omp_lock_t pending_lock;
+
+// Default of --max-tasks, per thread: enough queued folders that no thread runs out of work
+#define MAX_TASKS_PER_THREAD 64
+
+// Errors of the current traversal, each means that some bytes were not counted
+static int error_count = 0;
+
+#ifdef FOLDER_SIZE_STATS
+// Statistics of a traversal (--stats), compiled in with -DFOLDER_SIZE_STATS. Every thread counts in its own
+// cache line, indexed by omp_get_thread_num(), and walk_stats_sum() adds them up afterwards. Without
+// FOLDER_SIZE_STATS, STAT_ADD() and the busy timers are empty.
+
+// Threads with their own counters, higher thread numbers share them (and may lose updates)
+#define STATS_THREADS 256
+
+struct walk_stats {
+    _Alignas(64) uint64_t folders; // folders scanned
+    uint64_t cached_folders;       // of which the files were taken from the cache
+    uint64_t files;                // entries stat'ed that are not folders
+    uint64_t stat_calls;           // fstat(), fstatat() and statx requests
+    uint64_t open_calls;           // openat() calls and requests, one per sub-folder
+    uint64_t getdents_calls;
+    uint64_t uring_requests;       // of the stat and open calls, those that went through io_uring
+    uint64_t uring_enters;         // io_uring_enter() calls
+    uint64_t tasks;                // sub-folder tasks queued
+    uint64_t inline_folders;       // sub-folders scanned right away over --max-tasks
+    uint64_t pending_folders;      // sub-folders opened later, by path, over --max-open or out of descriptors
+    uint64_t chunk_tasks;          // tasks stat'ing a chunk of a large folder
+    double busy_seconds;           // time in the traversal's tasks
+    int busy_depth;                // tasks nested in a task of the same thread are part of its time
+};
+
+static struct walk_stats walk_stats[STATS_THREADS];
+
+#define STAT_ADD(field, n) (walk_stats[omp_get_thread_num() % STATS_THREADS].field += (n))
+
+/**
+ * @return the time the calling thread starts working on a task, or -1 if it is inside a task already
+ */
+static double stat_busy_start(void) {
+    struct walk_stats *stats = &walk_stats[omp_get_thread_num() % STATS_THREADS];
+    return stats->busy_depth++ == 0 ? omp_get_wtime() : -1.0;
+}
+
+/**
+ * Ends the work started with stat_busy_start(). Tasks are tied, so it ends on the same thread.
+ */
+static void stat_busy_end(double start) {
+    struct walk_stats *stats = &walk_stats[omp_get_thread_num() % STATS_THREADS];
+    stats->busy_depth--;
+    if (start >= 0.0) {
+        stats->busy_seconds += omp_get_wtime() - start;
+    }
+}
+
+#define STAT_BUSY_START(t) double t = stat_busy_start()
+#define STAT_BUSY_END(t) stat_busy_end(t)
+#else
+#define STAT_ADD(field, n) ((void) 0)
+#define STAT_BUSY_START(t) ((void) 0)
+#define STAT_BUSY_END(t) ((void) 0)
+#endif
+
+// The set of files with several links seen so far is split into this many shards, each with its own lock, so
+// tasks finding different files rarely wait for each other
+#define LINK_SHARDS 64
+
+// Identity of a file
+struct file_id {
+    uint64_t dev;
+    uint64_t ino; // 0 marks an empty slot, no file has inode 0
+};
+
+// One shard of the set: an open addressing hash table, at most half full
+struct link_shard {
+    _Alignas(64) omp_lock_t lock; // one cache line per shard
+    size_t count;
+    size_t capacity; // a power of two, or 0
+    struct file_id *slots;
+};
+
+static struct link_shard link_set[LINK_SHARDS];
+
+// A folder of the traversal. The walk itself only uses directory file descriptors, the names are kept to
+// build a path when an error message needs one. With keep_tree, the folders are kept until the end instead,
+// as a tree with the size of every folder.
+struct folder {
+    struct folder *parent;       // NULL for the folder given on the command line
+    struct folder *first_child;  // only with keep_tree: the sub-folders, linked by next_sibling
+    struct folder *next_sibling;
+    struct usage total;          // only with keep_tree: the folder with everything in it, complete when refs is 0
+    int depth;                   // 0 for the folder given on the command line
+    int refs;                    // the folder's own task and every sub-folder that still points to it
+    int uncacheable;             // the bytes of its files are not cached: it has files with several links, or errors
+    struct folder *next_pending; // in pending_folders
+    char name[];                 // name in the parent folder, or the path given on the command line
+};
+
+// Set if the sizes of all folders are needed (--depth, --top, --json): the folders are then allocated from the
+// arena and not freed during the traversal
+static int keep_tree = 0;
+
+// Folders of the tree are allocated from blocks of this size, every thread has its own current block
+#define ARENA_BLOCK (1024 * 1024)
+
+struct arena_block {
+    struct arena_block *next; // all blocks are in one list, to free them at the end
+    size_t used;
+    _Alignas(16) char data[ARENA_BLOCK];
+};
+
+// Number of the current traversal, --watch runs one after the other. Per-thread blocks (of the arena and of
+// the cache) that belong to an older traversal have been freed.
+static unsigned traversal = 0;
+
+static struct arena_block *arena_blocks = NULL;
+static struct arena_block *arena = NULL;
+static unsigned arena_traversal;
+#pragma omp threadprivate(arena, arena_traversal)
+
+/**
+ * @return size bytes from the calling thread's arena block, or NULL if a new block could not be allocated
+ */
+static void *arena_alloc(size_t size) {
+    size = (size + 15) & ~(size_t) 15;
+    if (arena == NULL || arena_traversal != traversal || arena->used + size > ARENA_BLOCK) {
+        if (size > ARENA_BLOCK) {
+            return NULL;
+        }
+        struct arena_block *block = (struct arena_block *) malloc(sizeof(struct arena_block));
+        if (block == NULL) {
+            return NULL;
+        }
+        block->used = 0;
+#pragma omp critical(arena)
+        {
+            block->next = arena_blocks;
+            arena_blocks = block;
+        }
+        arena = block;
+        arena_traversal = traversal;
+    }
+    void *memory = arena->data + arena->used;
+    arena->used += size;
+    return memory;
+}
+
+/**
+ * Frees all folders of the tree.
+ */
+static void arena_free(void) {
+    while (arena_blocks != NULL) {
+        struct arena_block *next = arena_blocks->next;
+        free(arena_blocks);
+        arena_blocks = next;
+    }
+}
+
+/**
+ * Creates the folder name inside parent, which then can't be freed before the new folder. Only the task
+ * scanning parent creates its sub-folders, so the list of children needs no lock.
+ * @return the folder, or NULL if it could not be allocated
+ */
+static struct folder *folder_new(struct folder *parent, const char *name) {
+    size_t length = strlen(name);
+    size_t size = sizeof(struct folder) + length + 1;
+    struct folder *folder = (struct folder *) (keep_tree ? arena_alloc(size) : malloc(size));
+    if (folder == NULL) {
+        return NULL;
+    }
+    memcpy(folder->name, name, length + 1);
+    folder->parent = parent;
+    folder->first_child = NULL;
+    folder->next_sibling = NULL;
+    folder->total.apparent = 0;
+    folder->total.allocated = 0;
+    folder->depth = parent != NULL ? parent->depth + 1 : 0;
+    folder->refs = 1;
+    folder->uncacheable = 0;
+    folder->next_pending = NULL;
+    if (parent != NULL) {
+        if (keep_tree) {
+            folder->next_sibling = parent->first_child;
+            parent->first_child = folder;
+        }
+#pragma omp atomic update
+        parent->refs++;
+    }
+    return folder;
+}
+
+/**
+ * Adds bytes found in the folder itself to its total (with keep_tree).
+ */
+static void folder_add(struct folder *folder, struct usage usage) {
+    if (keep_tree) {
+#pragma omp atomic update
+        folder->total.apparent += usage.apparent;
+#pragma omp atomic update
+        folder->total.allocated += usage.allocated;
+    }
+}
+
+/**
+ * Keeps the bytes of the folder's files out of the cache. Called by the tasks stat'ing them.
+ */
+static void folder_uncacheable(struct folder *folder) {
+#pragma omp atomic write
+    folder->uncacheable = 1;
+}
+
+/**
+ * Drops one reference to the folder. When the last one is gone, the folder and all its sub-folders are done.
+ * With keep_tree, its total is then complete and is added to the parent's total, otherwise the folder is
+ * freed. Either way, its reference to the parent is dropped next.
+ */
+static void folder_release(struct folder *folder) {
+    while (folder != NULL) {
+        int refs;
+        // seq_cst: what this task added to the totals is visible to whoever drops the last reference
+#pragma omp atomic capture seq_cst
+        refs = --folder->refs;
+        if (refs > 0) {
+            return;
+        }
+        struct folder *parent = folder->parent;
+        if (keep_tree && parent != NULL) {
+            folder_add(parent, folder->total);
+        } else if (!keep_tree) {
+            free(folder);
+        }
+        folder = parent;
+    }
+}
+
+/**
+ * @return the path of the entry in the folder (or of the folder itself if entry is NULL), to be freed with free(),
+ * or NULL if it could not be allocated
+ */
+static char *folder_path(const struct folder *folder, const char *entry) {
+    // The path is built from the end: entry, then the names of the folders up to the root
+    size_t length = entry != NULL ? strlen(entry) + 1 : 0;
+    for (const struct folder *f = folder; f != NULL; f = f->parent) {
+        length += strlen(f->name) + (f->parent != NULL);
+    }
+    char *path = (char *) malloc(length + 1);
+    if (path == NULL) {
+        return NULL;
+    }
+
+    size_t end = length;
+    path[end] = '\0';
+    if (entry != NULL) {
+        end -= strlen(entry);
+        memcpy(path + end, entry, strlen(entry));
+        path[--end] = '/';
+    }
+    for (const struct folder *f = folder; f != NULL; f = f->parent) {
+        end -= strlen(f->name);
+        memcpy(path + end, f->name, strlen(f->name));
+        if (f->parent != NULL) {
+            path[--end] = '/';
+        }
+    }
+    return path;
+}
+
+/**
+ * Prints "<what> ERROR: <path>: <reason of errno>", where path is the path of the entry in the folder
+ * (or of the folder itself if entry is NULL), for an error that did not lose any bytes.
+ */
+static void print_message(const char *what, const struct folder *folder, const char *entry) {
+    int error = errno;
+    char *path = folder_path(folder, entry);
+    if (path == NULL) {
+        fprintf(stderr, "%s ERROR: %s\n", what, strerror(error));
+        return;
+    }
+    fprintf(stderr, "%s ERROR: %s: %s\n", what, path, strerror(error));
+    free(path);
+}
+
+/**
+ * Prints the error like print_message() and counts it: the entry, or some of the folder, was not counted.
+ */
+static void print_error(const char *what, const struct folder *folder, const char *entry) {
+#pragma omp atomic update
+    error_count++;
+    print_message(what, folder, entry);
+}
+
+/**
+ * Initialises the set of files with several links, before the traversal.
+ */
+static void link_set_init(void) {
+    for (int i = 0; i < LINK_SHARDS; i++) {
+        omp_init_lock(&link_set[i].lock);
+        link_set[i].count = 0;
+        link_set[i].capacity = 0;
+        link_set[i].slots = NULL;
+    }
+}
+
+/**
+ * Frees the set of files with several links.
+ */
+static void link_set_free(void) {
+    for (int i = 0; i < LINK_SHARDS; i++) {
+        omp_destroy_lock(&link_set[i].lock);
+        free(link_set[i].slots);
+    }
+}
+
+/**
+ * @return a well mixed hash of the file identity, its lowest bits choose the shard
+ */
+static uint64_t file_hash(uint64_t dev, uint64_t ino) {
+    uint64_t x = ino * UINT64_C(0x9e3779b97f4a7c15) ^ dev;
+    x = (x ^ (x >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+    x = (x ^ (x >> 27)) * UINT64_C(0x94d049bb133111eb);
+    return x ^ (x >> 31);
+}
+
+/**
+ * Doubles the capacity of the shard, which has to be locked.
+ * @return 0 on success, -1 if the new table could not be allocated
+ */
+static int link_shard_grow(struct link_shard *shard) {
+    size_t capacity = shard->capacity > 0 ? shard->capacity * 2 : 1024;
+    struct file_id *slots = (struct file_id *) calloc(capacity, sizeof(struct file_id));
+    if (slots == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < shard->capacity; i++) {
+        const struct file_id *id = &shard->slots[i];
+        if (id->ino != 0) {
+            size_t j = (size_t) (file_hash(id->dev, id->ino) / LINK_SHARDS) & (capacity - 1);
+            while (slots[j].ino != 0) {
+                j = (j + 1) & (capacity - 1);
+            }
+            slots[j] = *id;
+        }
+    }
+    free(shard->slots);
+    shard->slots = slots;
+    shard->capacity = capacity;
+    return 0;
+}
+
+/**
+ * Adds the file to the set of files with several links.
+ * @return 1 if it was in the set already (another link to it has been counted), 0 otherwise
+ */
+static int link_seen(uint64_t dev, uint64_t ino) {
+    uint64_t hash = file_hash(dev, ino);
+    struct link_shard *shard = &link_set[hash % LINK_SHARDS];
+    int seen = 0;
+
+    omp_set_lock(&shard->lock);
+    if (2 * (shard->count + 1) > shard->capacity && link_shard_grow(shard) != 0 &&
+        shard->count == shard->capacity) {
+        // Out of memory and no free slot: the file is counted, maybe more than once
+        omp_unset_lock(&shard->lock);
+        return 0;
+    }
+    size_t mask = shard->capacity - 1;
+    size_t i = (size_t) (hash / LINK_SHARDS) & mask;
+    while (shard->slots[i].ino != 0) {
+        if (shard->slots[i].ino == ino && shard->slots[i].dev == dev) {
+            seen = 1;
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    if (!seen) {
+        shard->slots[i].dev = dev;
+        shard->slots[i].ino = ino;
+        shard->count++;
+    }
+    omp_unset_lock(&shard->lock);
+
+    return seen;
+}
+
+/**
+ * @param self = the folder the file is in
+ * @return the bytes of a file with the given stat() fields. A file with several links only counts for the first
+ * link found, unless count_links is set.
+ */
+static struct usage file_usage(struct folder *self, uint64_t dev, uint64_t ino, uint64_t nlink, uint64_t size,
+                               uint64_t blocks) {
+    struct usage usage = {0, 0};
+    if (nlink > 1 && !count_links) {
+        // Which link counts depends on the order of the traversal, a cached sum would not stay right
+        folder_uncacheable(self);
+        if (link_seen(dev, ino)) {
+            return usage;
+        }
+    }
+    usage.apparent = size;
+    usage.allocated = blocks * 512;
+    return usage;
+}
+
+static void usage_add(struct usage *usage, struct usage more) {
+    usage->apparent += more.apparent;
+    usage->allocated += more.allocated;
+}
+
+// The cache (--cache, --watch) keeps, for every folder of the last traversal, the bytes of the files directly in
+// it. They stay valid as long as the folder's mtime and ctime are unchanged: creating, deleting or renaming an
+// entry changes both, so the files of an unchanged folder are not stat'ed again. Its sub-folders are still read,
+// each is checked on its own. Writing to a file in place does not touch the folder, that is only noticed
+// through the inotify watches of --watch.
+#define CACHE_MAGIC "FOLDSIZE"
+#define CACHE_VERSION 1
+
+// Header of the cache file, followed by count entries sorted by dev and ino
+struct cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t count_links; // the sums depend on --count-links
+    uint64_t count;
+};
+
+// One folder in the cache
+struct cache_entry {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t ctime_sec;
+    int64_t ctime_nsec; // CACHE_STALE once an inotify event has been seen for the folder
+    struct usage files; // the files directly in the folder, not the folder itself or its sub-folders
+};
+
+// ctime_nsec of an invalidated entry, never the one of a real time stamp
+#define CACHE_STALE (-1)
+
+// Set with --cache or --watch: every folder is fstat'ed and looked up in the cache
+static int use_cache = 0;
+
+// Entries of the last traversal: the mapped cache file for the first one, then the entries of the one before
+static struct cache_entry *cache_entries = NULL;
+static size_t cache_count = 0;
+static void *cache_map = NULL; // mapping of the cache file, if cache_entries points into it
+static size_t cache_map_size = 0;
+
+// Folders changed in the second the traversal started or later are not cached: on file systems with time stamps
+// of one second, a later change in the same second would go unnoticed
+static time_t cache_not_after;
+
+// Entries of the current traversal are collected in blocks, every thread has its own current block
+#define CACHE_BLOCK 4096
+
+struct cache_block {
+    struct cache_block *next; // all blocks are in one list
+    size_t count;
+    struct cache_entry entries[CACHE_BLOCK];
+};
+
+static struct cache_block *cache_blocks = NULL;
+static struct cache_block *cache_block = NULL;
+static unsigned cache_block_traversal;
+#pragma omp threadprivate(cache_block, cache_block_traversal)
+
+/**
+ * Orders cache entries by dev, then ino.
+ */
+static int compare_cache_entries(const void *a, const void *b) {
+    const struct cache_entry *x = (const struct cache_entry *) a;
+    const struct cache_entry *y = (const struct cache_entry *) b;
+    if (x->dev != y->dev) {
+        return x->dev < y->dev ? -1 : 1;
+    }
+    return (x->ino > y->ino) - (x->ino < y->ino);
+}
+
+/**
+ * @return the entry of the folder in the cache, or NULL
+ */
+static struct cache_entry *cache_find(uint64_t dev, uint64_t ino) {
+    size_t low = 0;
+    size_t high = cache_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        struct cache_entry *entry = &cache_entries[middle];
+        if (entry->dev == dev && entry->ino == ino) {
+            return entry;
+        }
+        if (entry->dev < dev || (entry->dev == dev && entry->ino < ino)) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Drops the entries of the last traversal.
+ */
+static void cache_clear(void) {
+    if (cache_map != NULL) {
+        munmap(cache_map, cache_map_size);
+        cache_map = NULL;
+    } else {
+        free(cache_entries);
+    }
+    cache_entries = NULL;
+    cache_count = 0;
+}
+
+/**
+ * Maps the cache file written by an earlier run. A missing file is an empty cache, a file that does not fit
+ * (another version, or --count-links different) is ignored.
+ */
+static void cache_load(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            perror("CACHE OPEN ERROR");
+        }
+        return;
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || (size_t) sb.st_size < sizeof(struct cache_header)) {
+        fprintf(stderr, "CACHE ERROR: %s: not a cache file, ignored\n", path);
+        close(fd);
+        return;
+    }
+    // Private and writable, so --watch can mark entries stale without touching the file
+    void *map = mmap(NULL, (size_t) sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("CACHE MMAP ERROR");
+        return;
+    }
+
+    const struct cache_header *header = (const struct cache_header *) map;
+    if (memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) != 0 || header->version != CACHE_VERSION ||
+        header->count > ((size_t) sb.st_size - sizeof(struct cache_header)) / sizeof(struct cache_entry)) {
+        fprintf(stderr, "CACHE ERROR: %s: not a cache file of this version, ignored\n", path);
+        munmap(map, (size_t) sb.st_size);
+        return;
+    }
+    if (header->count_links != (uint32_t) count_links) {
+        // Not an error, the sums were just counted the other way
+        munmap(map, (size_t) sb.st_size);
+        return;
+    }
+    cache_map = map;
+    cache_map_size = (size_t) sb.st_size;
+    cache_entries = (struct cache_entry *) ((char *) map + sizeof(struct cache_header));
+    cache_count = header->count;
+}
+
+/**
+ * Adds the entry to the entries of the current traversal.
+ */
+static void cache_record(const struct cache_entry *entry) {
+    if (cache_block == NULL || cache_block_traversal != traversal || cache_block->count == CACHE_BLOCK) {
+        struct cache_block *block = (struct cache_block *) malloc(sizeof(struct cache_block));
+        if (block == NULL) {
+            return; // the folder is walked again next time
+        }
+        block->count = 0;
+#pragma omp critical(cache)
+        {
+            block->next = cache_blocks;
+            cache_blocks = block;
+        }
+        cache_block = block;
+        cache_block_traversal = traversal;
+    }
+    cache_block->entries[cache_block->count++] = *entry;
+}
+
+/**
+ * Replaces the entries of the last traversal by those of the current one, sorted.
+ */
+static void cache_finish(void) {
+    size_t count = 0;
+    for (const struct cache_block *block = cache_blocks; block != NULL; block = block->next) {
+        count += block->count;
+    }
+    struct cache_entry *entries = (struct cache_entry *) malloc((count > 0 ? count : 1) * sizeof(struct cache_entry));
+    size_t next = 0;
+    while (cache_blocks != NULL) {
+        struct cache_block *block = cache_blocks;
+        if (entries != NULL) {
+            memcpy(entries + next, block->entries, block->count * sizeof(struct cache_entry));
+            next += block->count;
+        }
+        cache_blocks = block->next;
+        free(block);
+    }
+
+    cache_clear();
+    if (entries == NULL) {
+        perror("CACHE MALLOC ERROR");
+        return;
+    }
+    qsort(entries, count, sizeof(struct cache_entry), compare_cache_entries);
+    cache_entries = entries;
+    cache_count = count;
+}
+
+/**
+ * Writes the entries of the last traversal to the cache file. A temporary file is renamed over it, so another
+ * run never maps a half written cache.
+ */
+static void cache_save(const char *path) {
+    size_t length = strlen(path);
+    char *temporary = (char *) malloc(length + 5);
+    if (temporary == NULL) {
+        perror("CACHE MALLOC ERROR");
+        return;
+    }
+    memcpy(temporary, path, length);
+    memcpy(temporary + length, ".tmp", 5);
+
+    struct cache_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_VERSION;
+    header.count_links = (uint32_t) count_links;
+    header.count = cache_count;
+
+    FILE *file = fopen(temporary, "wb");
+    if (file == NULL || fwrite(&header, sizeof(header), 1, file) != 1 ||
+        fwrite(cache_entries, sizeof(struct cache_entry), cache_count, file) != cache_count) {
+        perror("CACHE WRITE ERROR");
+        if (file != NULL) {
+            fclose(file);
+        }
+        unlink(temporary);
+    } else if (fclose(file) != 0 || rename(temporary, path) != 0) {
+        perror("CACHE WRITE ERROR");
+        unlink(temporary);
+    }
+    free(temporary);
+}
+
+/**
+ * fstat()s the folder and looks it up in the cache.
+ * @param fd = descriptor of the folder
+ * @param self = the folder
+ * @param own = set to the bytes of the folder itself
+ * @param entry = set to the folder's entry for the next traversal (ino 0 if it could not be stat'ed), and if
+ * the folder is unchanged, with the cached bytes of its files
+ * @return 1 if the folder is unchanged since the last traversal, 0 otherwise
+ */
+static int cache_stat(int fd, struct folder *self, struct usage *own, struct cache_entry *entry) {
+    struct stat sb;
+    memset(entry, 0, sizeof(*entry));
+    STAT_ADD(stat_calls, 1);
+    if (fstat(fd, &sb) != 0) {
+        print_error("FSTAT", self, NULL);
+        own->apparent = 0;
+        own->allocated = 0;
+        return 0;
+    }
+    own->apparent = sb.st_size;
+    own->allocated = (uint64_t) sb.st_blocks * 512;
+
+    entry->dev = sb.st_dev;
+    entry->ino = sb.st_ino;
+    entry->mtime_sec = sb.st_mtim.tv_sec;
+    entry->mtime_nsec = sb.st_mtim.tv_nsec;
+    entry->ctime_sec = sb.st_ctim.tv_sec;
+    entry->ctime_nsec = sb.st_ctim.tv_nsec;
+
+    const struct cache_entry *cached = cache_find(entry->dev, entry->ino);
+    if (cached == NULL || cached->mtime_sec != entry->mtime_sec || cached->mtime_nsec != entry->mtime_nsec ||
+        cached->ctime_sec != entry->ctime_sec || cached->ctime_nsec != entry->ctime_nsec) {
+        return 0;
+    }
+    entry->files = cached->files;
+    return 1;
+}
+
+/**
+ * Records the bytes of the files directly in the folder for the next traversal, unless they might not stay right.
+ * @param entry = from cache_stat()
+ */
+static void cache_store(const struct folder *self, struct cache_entry *entry, struct usage files) {
+    int uncacheable;
+#pragma omp atomic read
+    uncacheable = self->uncacheable;
+    if (entry->ino == 0 || uncacheable || entry->mtime_sec >= cache_not_after || entry->ctime_sec >= cache_not_after) {
+        return;
+    }
+    entry->files = files;
+    cache_record(entry);
+}
+
+#ifdef __linux__
+
+// Set with --watch: every folder gets an inotify watch, and its entry is marked stale on any event in it
+static int watch_fd = -1;
+
+// Folder of every watch descriptor
+static struct file_id *watched = NULL;
+static size_t watched_capacity = 0;
+
+#define WATCH_MASK (IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+
+/**
+ * Adds an inotify watch for the folder, through its descriptor. Watching a folder again gives the same watch
+ * descriptor, so each folder has one watch however many traversals see it.
+ * @param entry = from cache_stat()
+ */
+static void watch_folder(int fd, const struct folder *self, const struct cache_entry *entry) {
+    static int full = 0;
+    int stop;
+#pragma omp atomic read
+    stop = full;
+    if (watch_fd < 0 || entry->ino == 0 || stop) {
+        return;
+    }
+
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    int wd = inotify_add_watch(watch_fd, path, WATCH_MASK);
+    if (wd < 0) {
+        if (errno == ENOSPC) {
+            // Out of watches (fs.inotify.max_user_watches): the other folders only notice added or removed entries
+#pragma omp atomic write
+            full = 1;
+        }
+        print_message("INOTIFY_ADD_WATCH", self, NULL);
+        return;
+    }
+
+#pragma omp critical(watch)
+    {
+        if ((size_t) wd >= watched_capacity) {
+            size_t capacity = watched_capacity > 0 ? watched_capacity : 1024;
+            while (capacity <= (size_t) wd) {
+                capacity *= 2;
+            }
+            struct file_id *grown = (struct file_id *) realloc(watched, capacity * sizeof(struct file_id));
+            if (grown != NULL) {
+                memset(grown + watched_capacity, 0, (capacity - watched_capacity) * sizeof(struct file_id));
+                watched = grown;
+                watched_capacity = capacity;
+            }
+        }
+        if ((size_t) wd < watched_capacity) {
+            watched[wd].dev = entry->dev;
+            watched[wd].ino = entry->ino;
+        }
+    }
+}
+
+/**
+ * Waits the given number of seconds for the next traversal, marking the entries of folders stale as their
+ * inotify events come in.
+ */
+static void watch_wait(int seconds) {
+    double end = omp_get_wtime() + seconds;
+    _Alignas(struct inotify_event) char buf[64 * 1024];
+
+    for (;;) {
+        double left = end - omp_get_wtime();
+        if (left <= 0) {
+            return;
+        }
+        struct pollfd ready = {watch_fd, POLLIN, 0};
+        int polled = poll(&ready, 1, (int) (left * 1000) + 1);
+        if (polled < 0 && errno != EINTR) {
+            perror("POLL ERROR");
+            return;
+        }
+        if (polled <= 0) {
+            continue;
+        }
+
+        ssize_t nread = read(watch_fd, buf, sizeof(buf));
+        if (nread < 0) {
+            if (errno != EINTR && errno != EAGAIN) {
+                perror("INOTIFY READ ERROR");
+                return;
+            }
+            continue;
+        }
+        for (ssize_t offset = 0; offset < nread;) {
+            const struct inotify_event *event = (const struct inotify_event *) (buf + offset);
+            offset += (ssize_t) (sizeof(struct inotify_event) + event->len);
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                // Events were lost, so it is not known which folders changed
+                for (size_t i = 0; i < cache_count; i++) {
+                    cache_entries[i].ctime_nsec = CACHE_STALE;
+                }
+            } else if (event->wd >= 0 && (size_t) event->wd < watched_capacity) {
+                struct file_id *folder = &watched[event->wd];
+                struct cache_entry *entry = cache_find(folder->dev, folder->ino);
+                if (entry != NULL) {
+                    entry->ctime_nsec = CACHE_STALE;
+                }
+                if (event->mask & IN_IGNORED) {
+                    folder->ino = 0; // the folder is gone, its watch descriptor can be given to another one
+                }
+            }
+        }
+    }
+}
+
+#endif
+
+static struct usage scan_folder(int fd, struct folder *self, const struct usage *own);
+
+// Flags of every sub-folder that is opened
+#define SUB_FOLDER_FLAGS (O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)
+
+/**
+ * @return whether the entry name of a folder is "." or ".."
+ */
+static int is_dot_or_dot_dot(const char *name) {
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+/**
+ * Counts up to count descriptors of folders in open_folders, as many as max_open_folders still allows.
+ * @return the number of reserved descriptors, 0 to count
+ */
+static unsigned reserve_open_folders(unsigned count) {
+    omp_set_lock(&pending_lock);
+    int free_descriptors = max_open_folders - open_folders;
+    unsigned reserved = free_descriptors <= 0 ? 0 : (unsigned) free_descriptors < count ? (unsigned) free_descriptors
+                                                                                      : count;
+    open_folders += (int) reserved;
+    omp_unset_lock(&pending_lock);
+    return reserved;
+}
+
+/**
+ * Creates the sub-folder name of the folder and puts it on pending_folders. The calling task holds the folder's
+ * descriptor, so the sub-folder is opened at the latest when that is given back.
+ * @param reserved = whether a descriptor was reserved for the sub-folder, which is given back
+ */
+static void pend_sub_folder(struct folder *self, const char *name, int reserved) {
+    struct folder *child = folder_new(self, name);
+    if (child == NULL) {
+        print_error("MALLOC", self, name);
+    }
+    STAT_ADD(pending_folders, child != NULL);
+
+    omp_set_lock(&pending_lock);
+    if (reserved) {
+        open_folders--;
+    }
+    if (child != NULL) {
+        child->next_pending = pending_folders;
+        pending_folders = child;
+    }
+    omp_unset_lock(&pending_lock);
+}
+
+static void spawn_sub_folder(int child_fd, struct folder *child, const struct usage *own);
+
+/**
+ * Gives back a descriptor counted in open_folders. Then, as long as sub-folders are pending and max_open_folders
+ * allows, opens them by their path and creates their tasks. Nothing ever waits for a descriptor: a sub-folder
+ * that finds none stays pending until a folder that holds one gives it back.
+ */
+static void release_open_folder(void) {
+    omp_set_lock(&pending_lock);
+    open_folders--;
+    while (pending_folders != NULL && open_folders < max_open_folders) {
+        struct folder *child = pending_folders;
+        pending_folders = child->next_pending;
+        open_folders++;
+        omp_unset_lock(&pending_lock);
+
+        STAT_ADD(open_calls, 1);
+        char *path = folder_path(child, NULL);
+        int fd = path != NULL ? openat(AT_FDCWD, path, SUB_FOLDER_FLAGS) : -1;
+        int error = path != NULL ? errno : ENOMEM;
+        free(path);
+        if (fd >= 0) {
+            spawn_sub_folder(fd, child, NULL);
+            omp_set_lock(&pending_lock);
+            continue;
+        }
+
+        omp_set_lock(&pending_lock);
+        open_folders--;
+        if (error == EMFILE && open_folders > 0) {
+            // Taken by something else after all: pending again, for the next folder that gives a descriptor back
+            child->next_pending = pending_folders;
+            pending_folders = child;
+            break;
+        }
+        omp_unset_lock(&pending_lock);
+        errno = error;
+        print_error("OPENAT", child->parent, child->name);
+        folder_release(child);
+        omp_set_lock(&pending_lock);
+    }
+    omp_unset_lock(&pending_lock);
+}
+
+/**
+ * Creates the task that scans the sub-folder child. Once it is done, it gives back its descriptor, which opens
+ * sub-folders that are pending. If max_queued_tasks tasks are queued already, the task is undeferred instead: the
+ * calling thread scans the sub-folder right away, depth-first. That holds one more descriptor, but never waits
+ * for one.
+ * @param child_fd = open descriptor of the sub-folder, already counted in open_folders, the task closes it and
+ * gives it back
+ * @param own = bytes of the sub-folder itself if they are known already, otherwise NULL
+ */
+static void spawn_sub_folder(int child_fd, struct folder *child, const struct usage *own) {
+    int own_known = own != NULL;
+    struct usage own_usage = {0, 0};
+    if (own_known) {
+        own_usage = *own;
+    }
+    int queued;
+#pragma omp atomic capture
+    queued = queued_tasks++;
+    int deferred = queued < max_queued_tasks;
+    if (deferred) {
+        STAT_ADD(tasks, 1);
+    } else {
+#pragma omp atomic update
+        queued_tasks--;
+        STAT_ADD(inline_folders, 1);
+    }
+
+    // The task gets the new descriptor and the folder, which are both its own --> firstprivate. Instead of all
+    // tasks updating shared variables atomically, every task adds to its own copies of the totals
+    // --> in_reduction.
+#pragma omp task firstprivate(child_fd, child, own_known, own_usage, deferred) if(deferred) \
+    in_reduction(+:folder_apparent_total, folder_allocated_total)
+    {
+        STAT_BUSY_START(busy_start);
+        // recursive call, the sub-folder's own sub-folders become tasks of their own
+        struct usage usage = scan_folder(child_fd, child, own_known ? &own_usage : NULL);
+        folder_apparent_total += usage.apparent;
+        folder_allocated_total += usage.allocated;
+        folder_add(child, usage);
+        if (deferred) {
+#pragma omp atomic update
+            queued_tasks--;
+        }
+        release_open_folder();
+        STAT_BUSY_END(busy_start);
+
+        // No longer needed.
+        folder_release(child);
+    }
+}
+
+/**
+ * Opens the sub-folder name of the folder and creates the task that scans it. The sub-folder is opened here,
+ * while the folder's descriptor is certainly still open. If max_open_folders descriptors are open, or the process
+ * has none left, the sub-folder is pending instead.
+ * @param folder_fd = descriptor of the folder
+ * @param self = the folder
+ * @param own = bytes of the sub-folder itself if they are known already, otherwise NULL
+ */
+static void visit_sub_folder(int folder_fd, struct folder *self, const char *name, const struct usage *own) {
+    if (is_dot_or_dot_dot(name)) {
+        return;
+    }
+
+    if (reserve_open_folders(1) == 0) {
+        pend_sub_folder(self, name, 0);
+        return;
+    }
+    STAT_ADD(open_calls, 1);
+    int child_fd = openat(folder_fd, name, SUB_FOLDER_FLAGS);
+    if (child_fd < 0 && errno == EMFILE) {
+        pend_sub_folder(self, name, 1);
+        return;
+    }
+    if (child_fd < 0) {
+        print_error("OPENAT", self, name);
+        release_open_folder();
+        return;
+    }
+    struct folder *child = folder_new(self, name);
+    if (child == NULL) {
+        print_error("MALLOC", self, name);
+        close(child_fd);
+        release_open_folder();
+        return;
+    }
+    spawn_sub_folder(child_fd, child, own);
+}
+
+/**
+ * lstat() of the entry name relative to the folder, symbolic links count with their own size.
+ * @return bytes of the entry, 0 if it could not be stat'ed
+ */
+static struct usage stat_entry(int folder_fd, struct folder *self, const char *name) {
+    struct stat sb;
+    STAT_ADD(stat_calls, 1);
+    STAT_ADD(files, 1);
+    if (fstatat(folder_fd, name, &sb, AT_SYMLINK_NOFOLLOW) != 0) {
+        print_error("LSTAT", self, name);
+        folder_uncacheable(self);
+        struct usage none = {0, 0};
+        return none;
+    }
+    return file_usage(self, sb.st_dev, sb.st_ino, sb.st_nlink, sb.st_size, sb.st_blocks);
+}
+
+/**
+ * Handles an entry the file system did not give a type for (DT_UNKNOWN, e.g. XFS without ftype or some FUSE and
+ * NFS mounts) with the one fstatat() it needs anyway: a file is counted, and a folder gets its task, which takes
+ * the folder's own size from this stat.
+ * @return bytes of the file, 0 for a folder
+ */
+static struct usage visit_unknown(int folder_fd, struct folder *self, const char *name) {
+    struct usage usage = {0, 0};
+    if (is_dot_or_dot_dot(name)) {
+        return usage;
+    }
+
+    struct stat sb;
+    STAT_ADD(stat_calls, 1);
+    if (fstatat(folder_fd, name, &sb, AT_SYMLINK_NOFOLLOW) != 0) {
+        print_error("LSTAT", self, name);
+        folder_uncacheable(self);
+        return usage;
+    }
+    if (!S_ISDIR(sb.st_mode)) {
+        STAT_ADD(files, 1);
+        return file_usage(self, sb.st_dev, sb.st_ino, sb.st_nlink, sb.st_size, sb.st_blocks);
+    }
+    struct usage own = {(uint64_t) sb.st_size, (uint64_t) sb.st_blocks * 512};
+    visit_sub_folder(folder_fd, self, name, &own);
+    return usage;
+}
+
+/**
+ * @return bytes of the folder itself (not of its entries), 0 if they could not be found out
+ */
+static struct usage folder_own_usage(int fd, const struct folder *self) {
+    struct stat sb;
+    struct usage usage = {0, 0};
+    STAT_ADD(stat_calls, 1);
+    if (fstat(fd, &sb) != 0) {
+        print_error("FSTAT", self, NULL);
+        return usage;
+    }
+    usage.apparent = sb.st_size;
+    usage.allocated = (uint64_t) sb.st_blocks * 512;
+    return usage;
+}
+
+#ifdef __linux__
+
+/**
+ * Sets up the ring r with URING_ENTRIES entries, without liburing.
+ * @return 0 on success, -1 on error (errno is set)
+ */
+static int uring_init(struct uring *r) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int) syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (fd < 0) {
+        return -1;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_size = cq_size = sq_size > cq_size ? sq_size : cq_size;
+    }
+    char *sq = (char *) mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    char *cq = sq;
+    if (sq != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        cq = (char *) mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    }
+    void *sqes = MAP_FAILED;
+    if (sq != MAP_FAILED && cq != MAP_FAILED) {
+        sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    }
+    r->stx = (struct statx *) malloc(URING_ENTRIES * sizeof(struct statx));
+    r->res = (int *) malloc(URING_ENTRIES * sizeof(int));
+    if (sqes == MAP_FAILED || r->stx == NULL || r->res == NULL) {
+        // The ring is only set up once per thread, so the mappings of a failed attempt are not worth unmapping
+        free(r->stx);
+        free(r->res);
+        close(fd);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    r->sq_head = (unsigned *) (sq + params.sq_off.head);
+    r->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    r->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    r->sq_array = (unsigned *) (sq + params.sq_off.array);
+    r->cq_head = (unsigned *) (cq + params.cq_off.head);
+    r->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    r->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    r->sqes = (struct io_uring_sqe *) sqes;
+    r->fd = fd;
+    return 0;
+}
+
+/**
+ * @return the ring of the calling thread, or NULL if io_uring is not used (not asked for, or not available)
+ */
+static struct uring *uring_get(void) {
+    if (!use_uring || ring.fd == -2) {
+        return NULL;
+    }
+    if (ring.fd == -1 && uring_init(&ring) != 0) {
+        static int reported = 0;
+        int report;
+#pragma omp atomic capture
+        report = reported++;
+        if (report == 0) {
+            perror("IO_URING ERROR, using fstatat() and openat()");
+        }
+        ring.fd = -2;
+        return NULL;
+    }
+    return &ring;
+}
+
+/**
+ * @return the i-th submission queue entry of the next batch, cleared
+ */
+static struct io_uring_sqe *uring_sqe(struct uring *r, unsigned i) {
+    unsigned index = (*r->sq_tail + i) & *r->sq_mask;
+    r->sq_array[index] = index;
+    struct io_uring_sqe *sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = i;
+    return sqe;
+}
+
+/**
+ * Submits the count requests prepared with uring_sqe() and waits for all of them. The result of request i
+ * (>= 0, or -errno) is stored in r->res[i].
+ * @return 0 on success, -1 if io_uring_enter() failed (errno is set, the ring can't be used anymore)
+ */
+static int uring_run(struct uring *r, unsigned count) {
+    __atomic_store_n(r->sq_tail, *r->sq_tail + count, __ATOMIC_RELEASE);
+
+    unsigned pending = count;
+    while (pending > 0) {
+        STAT_ADD(uring_enters, 1);
+        long submitted = syscall(__NR_io_uring_enter, r->fd, pending, 0, 0, NULL, 0);
+        if (submitted < 0 && errno != EINTR) {
+            return -1;
+        }
+        if (submitted > 0) {
+            pending -= (unsigned) submitted;
+        }
+    }
+
+    unsigned done = 0;
+    while (done < count) {
+        unsigned head = *r->cq_head;
+        unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++, done++) {
+            const struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+            r->res[cqe->user_data] = cqe->res;
+        }
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+        STAT_ADD(uring_enters, done < count);
+
+        if (done < count && syscall(__NR_io_uring_enter, r->fd, 0, count - done, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+            errno != EINTR) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Gives up the ring of the calling thread after an error, the thread continues without io_uring.
+ */
+static void uring_fail(struct uring *r, const struct folder *self) {
+    print_message("IO_URING_ENTER", self, NULL);
+    close(r->fd);
+    r->fd = -2;
+}
+
+/**
+ * Opens the sub-folders names[0..count-1] of the folder through the ring, all at once, and then creates their
+ * tasks. The tasks are only created once the ring is idle again, because a task may be run right away by this
+ * thread.
+ * @param count = sub-folders, their descriptors are reserved in open_folders already
+ */
+static void open_sub_folder_batch(struct uring *r, int folder_fd, struct folder *self, const char *const *names,
+                                  unsigned count) {
+    int fds[URING_OPEN_BATCH];
+
+    for (unsigned i = 0; i < count; i++) {
+        struct io_uring_sqe *sqe = uring_sqe(r, i);
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = folder_fd;
+        sqe->addr = (uint64_t) (uintptr_t) names[i];
+        sqe->open_flags = SUB_FOLDER_FLAGS;
+    }
+    STAT_ADD(open_calls, count);
+    STAT_ADD(uring_requests, count);
+    if (uring_run(r, count) != 0) {
+        // Opens that did complete are lost with the ring, the sub-folders are opened again one by one
+        uring_fail(r, self);
+        omp_set_lock(&pending_lock);
+        open_folders -= (int) count;
+        omp_unset_lock(&pending_lock);
+        for (unsigned i = 0; i < count; i++) {
+            visit_sub_folder(folder_fd, self, names[i], NULL);
+        }
+        return;
+    }
+    memcpy(fds, r->res, count * sizeof(int));
+
+    for (unsigned i = 0; i < count; i++) {
+        if (fds[i] == -EMFILE) {
+            pend_sub_folder(self, names[i], 1);
+        } else if (fds[i] < 0) {
+            errno = -fds[i];
+            print_error("OPENAT", self, names[i]);
+            release_open_folder();
+        } else {
+            struct folder *child = folder_new(self, names[i]);
+            if (child == NULL) {
+                print_error("MALLOC", self, names[i]);
+                close(fds[i]);
+                release_open_folder();
+                continue;
+            }
+            spawn_sub_folder(fds[i], child, NULL);
+        }
+    }
+}
+
+/**
+ * Opens the sub-folders names[0..count-1] of the folder through the ring and creates their tasks. Their
+ * descriptors are reserved in open_folders before they are opened, so if only a few are free, the sub-folders are
+ * opened a few at a time, and if none is free, the rest are pending.
+ */
+static void open_sub_folders(int folder_fd, struct folder *self, const char *const *names, unsigned count) {
+    while (count > 0) {
+        struct uring *r = uring_get();
+        if (r == NULL) {
+            // The ring failed in an earlier batch
+            for (unsigned i = 0; i < count; i++) {
+                visit_sub_folder(folder_fd, self, names[i], NULL);
+            }
+            return;
+        }
+        unsigned batch = reserve_open_folders(count);
+        if (batch == 0) {
+            for (unsigned i = 0; i < count; i++) {
+                pend_sub_folder(self, names[i], 0);
+            }
+            return;
+        }
+        open_sub_folder_batch(r, folder_fd, self, names, batch);
+        names += batch;
+        count -= batch;
+    }
+}
+
+/**
+ * Stats the entries names[0..count-1] of the folder through the ring, all at once.
+ * @return their bytes
+ */
+static struct usage uring_stat(struct uring *r, int folder_fd, struct folder *self, const char *const *names,
+                               unsigned count) {
+    for (unsigned i = 0; i < count; i++) {
+        struct io_uring_sqe *sqe = uring_sqe(r, i);
+        sqe->opcode = IORING_OP_STATX;
+        sqe->fd = folder_fd;
+        sqe->addr = (uint64_t) (uintptr_t) names[i];
+        sqe->len = STATX_SIZE | STATX_BLOCKS | STATX_NLINK | STATX_INO;
+        sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+        sqe->addr2 = (uint64_t) (uintptr_t) &r->stx[i];
+    }
+    STAT_ADD(stat_calls, count);
+    STAT_ADD(files, count);
+    STAT_ADD(uring_requests, count);
+    if (uring_run(r, count) != 0) {
+        uring_fail(r, self);
+        struct usage usage = {0, 0};
+        for (unsigned i = 0; i < count; i++) {
+            usage_add(&usage, stat_entry(folder_fd, self, names[i]));
+        }
+        return usage;
+    }
+
+    struct usage usage = {0, 0};
+    for (unsigned i = 0; i < count; i++) {
+        const struct statx *stx = &r->stx[i];
+        if (r->res[i] < 0) {
+            errno = -r->res[i];
+            print_error("LSTAT", self, names[i]);
+            folder_uncacheable(self);
+        } else {
+            // makedev() gives the same number as st_dev, so files found by both paths are the same
+            usage_add(&usage, file_usage(self, makedev(stx->stx_dev_major, stx->stx_dev_minor), stx->stx_ino,
+                                         stx->stx_nlink, stx->stx_size, stx->stx_blocks));
+        }
+    }
+    return usage;
+}
+
+/**
+ * @return whether the getdents64() record of the type still has to be stat'ed: it is not a folder, and not an
+ * entry of unknown type that has been counted already
+ */
+static int needs_stat(unsigned char type) {
+    return type != DT_DIR && type != DT_COUNTED;
+}
+
+/**
+ * Stats all entries that are not folders among the getdents64() records buf[begin..end-1].
+ * @return their bytes
+ */
+static struct usage stat_entries(int folder_fd, struct folder *self, const char *buf, size_t begin,
+                                 size_t end) {
+    struct uring *r = uring_get();
+    const char *names[URING_ENTRIES];
+    unsigned count = 0;
+    struct usage usage = {0, 0};
+
+    for (size_t offset = begin; offset < end;) {
+        const struct linux_dirent64 *element = (const struct linux_dirent64 *) (buf + offset);
+        if (needs_stat(element->d_type)) {
+            if (r == NULL) {
+                usage_add(&usage, stat_entry(folder_fd, self, element->d_name));
+            } else {
+                names[count++] = element->d_name;
+                if (count == URING_ENTRIES) {
+                    usage_add(&usage, uring_stat(r, folder_fd, self, names, count));
+                    count = 0;
+                    r = uring_get(); // NULL if the ring failed
+                }
+            }
+        }
+        offset += element->d_reclen;
+    }
+    if (count > 0) {
+        usage_add(&usage, uring_stat(r, folder_fd, self, names, count));
+    }
+    return usage;
+}
+
+/**
+ * Adds up the sizes of the files in a folder and creates a task for every sub-folder. The sizes of the
+ * sub-folders are added to the totals by their tasks, so the folder does not wait for them.
+ * Everything is looked up relative to the folder's file descriptor, so the kernel never resolves a full
+ * path again, and no path strings are built. The entries are read with getdents64() in large batches.
+ * The files of a batch with more than STAT_CHUNK of them are stat'ed by several tasks. With the cache, the files
+ * of an unchanged folder are not stat'ed at all.
+ * @param fd = open file descriptor of the folder, closed by this function
+ * @param self = the folder, for error messages
+ * @param own = bytes of the folder itself if they are known already (from the stat that found it is a folder),
+ * otherwise NULL
+ * @return bytes of the folder itself and of its files
+ */
+static struct usage scan_folder(int fd, struct folder *self, const struct usage *own) {
+
+    size_t buf_size = GETDENTS_SMALL_BUFFER;
+    char *buf = (char *) malloc(buf_size);
+    struct usage usage;
+    struct cache_entry entry;
+    int cached = 0;
+    STAT_ADD(folders, 1);
+    if (use_cache) {
+        cached = cache_stat(fd, self, &usage, &entry);
+        STAT_ADD(cached_folders, cached);
+        watch_folder(fd, self, &entry);
+    } else {
+        usage = own != NULL ? *own : folder_own_usage(fd, self);
+    }
+    struct usage own_usage = usage;
+    struct usage chunks = {0, 0}; // files stat'ed by the chunk tasks
+
+    if (buf == NULL) {
+        print_error("MALLOC", self, NULL);
+        close(fd);
+        return usage;
+    }
+
+    for (;;) {
+        STAT_ADD(getdents_calls, 1);
+        long nread = syscall(SYS_getdents64, fd, buf, buf_size);
+        if (nread < 0) {
+            print_error("GETDENTS", self, NULL);
+            folder_uncacheable(self);
+            break;
+        }
+        if (nread == 0) {
+            break;
+        }
+
+        // First all sub-folders of the batch, their tasks must not be part of the taskgroup below
+        struct uring *r = uring_get();
+        const char *sub_folders[URING_OPEN_BATCH];
+        unsigned count = 0;
+        size_t files = 0;
+        for (long offset = 0; offset < nread;) {
+            struct linux_dirent64 *element = (struct linux_dirent64 *) (buf + offset);
+            if (element->d_type == DT_UNKNOWN) {
+                // Its stat() tells whether it is a folder, so it is counted right now and not stat'ed again below
+                struct usage file = visit_unknown(fd, self, element->d_name);
+                if (!cached) {
+                    usage_add(&usage, file);
+                }
+                element->d_type = DT_COUNTED;
+            } else if (element->d_type != DT_DIR) {
+                files++;
+            } else if (r == NULL) {
+                visit_sub_folder(fd, self, element->d_name, NULL);
+            } else if (!is_dot_or_dot_dot(element->d_name)) {
+                sub_folders[count++] = element->d_name;
+                if (count == URING_OPEN_BATCH) {
+                    open_sub_folders(fd, self, sub_folders, count);
+                    count = 0;
+                    r = uring_get();
+                }
+            }
+            offset += element->d_reclen;
+        }
+        if (count > 0) {
+            open_sub_folders(fd, self, sub_folders, count);
+        }
+
+        if (cached) {
+            // The files are in the cached sum
+        } else if (files <= STAT_CHUNK) {
+            usage_add(&usage, stat_entries(fd, self, buf, 0, (size_t) nread));
+        } else {
+            // The taskgroup only waits for the stat tasks, before buf is read into again
+#pragma omp taskgroup
+            {
+                size_t begin = 0;
+                size_t count = 0;
+                for (size_t offset = 0; offset < (size_t) nread;) {
+                    const struct linux_dirent64 *element = (const struct linux_dirent64 *) (buf + offset);
+                    offset += element->d_reclen;
+                    count += needs_stat(element->d_type);
+                    if (count == STAT_CHUNK && offset < (size_t) nread) {
+                        STAT_ADD(chunk_tasks, 1);
+#pragma omp task firstprivate(begin, offset) shared(chunks) \
+    in_reduction(+:folder_apparent_total, folder_allocated_total)
+                        {
+                            STAT_BUSY_START(busy_start);
+                            struct usage chunk = stat_entries(fd, self, buf, begin, offset);
+                            folder_apparent_total += chunk.apparent;
+                            folder_allocated_total += chunk.allocated;
+                            folder_add(self, chunk);
+#pragma omp atomic update
+                            chunks.apparent += chunk.apparent;
+#pragma omp atomic update
+                            chunks.allocated += chunk.allocated;
+                            STAT_BUSY_END(busy_start);
+                        }
+                        begin = offset;
+                        count = 0;
+                    }
+                }
+                // The last chunk is stat'ed by this task itself
+                usage_add(&usage, stat_entries(fd, self, buf, begin, (size_t) nread));
+            }
+        }
+
+        if (buf_size == GETDENTS_SMALL_BUFFER && (size_t) nread >= GETDENTS_SMALL_BUFFER / 2) {
+            char *large = (char *) malloc(GETDENTS_LARGE_BUFFER);
+            if (large != NULL) {
+                free(buf);
+                buf = large;
+                buf_size = GETDENTS_LARGE_BUFFER;
+            }
+        }
+    }
+    free(buf);
+    close(fd);
+
+    if (use_cache) {
+        if (cached) {
+            usage_add(&usage, entry.files);
+        }
+        struct usage files = {usage.apparent - own_usage.apparent + chunks.apparent,
+                              usage.allocated - own_usage.allocated + chunks.allocated};
+        cache_store(self, &entry, files);
+    }
+    return usage;
+}
+
+#else
+
+/**
+ * Adds up the sizes of the files in a folder and creates a task for every sub-folder. The sizes of the
+ * sub-folders are added to the totals by their tasks, so the folder does not wait for them.
+ * Everything is looked up relative to the folder's file descriptor, so the kernel never resolves a full
+ * path again, and no path strings are built. With the cache, the files of an unchanged folder are not stat'ed.
+ * @param fd = open file descriptor of the folder, closed by this function
+ * @param self = the folder, for error messages
+ * @param own = bytes of the folder itself if they are known already (from the stat that found it is a folder),
+ * otherwise NULL
+ * @return bytes of the folder itself and of its files
+ */
+static struct usage scan_folder(int fd, struct folder *self, const struct usage *own) {
+
+    struct usage usage;
+    struct cache_entry entry;
+    int cached = 0;
+    STAT_ADD(folders, 1);
+    if (use_cache) {
+        cached = cache_stat(fd, self, &usage, &entry);
+        STAT_ADD(cached_folders, cached);
+    } else {
+        usage = own != NULL ? *own : folder_own_usage(fd, self);
+    }
+    struct usage own_usage = usage;
+    DIR *folder = fdopendir(fd);
+
+    if (folder == NULL) {
+        print_error("FDOPENDIR", self, NULL);
+        close(fd);
+        return usage;
+    }
+
+    int folder_fd = dirfd(folder);
+    struct dirent *element;
+
+
+    for (element = readdir(folder); element != NULL; element = readdir(folder)) {
+
+        // if directory
+        if (element->d_type == DT_DIR) {
+            visit_sub_folder(folder_fd, self, element->d_name, NULL);
+        } else if (element->d_type == DT_UNKNOWN) {
+            struct usage file = visit_unknown(folder_fd, self, element->d_name);
+            if (!cached) {
+                usage_add(&usage, file);
+            }
+        } else if (!cached) {
+            usage_add(&usage, stat_entry(folder_fd, self, element->d_name));
+        }
+    }
+    closedir(folder);
+
+    if (use_cache) {
+        if (cached) {
+            usage_add(&usage, entry.files);
+        }
+        struct usage files = {usage.apparent - own_usage.apparent, usage.allocated - own_usage.allocated};
+        cache_store(self, &entry, files);
+    }
+    return usage;
+}
+
+#endif
+
+/**
+ * @param tree = with keep_tree, set to the root of the folder tree (NULL if path is a file), otherwise NULL
+ * @return the bytes of the file or folder path with everything in it
+ */
+struct usage calculate_folder_size(const char *path, struct folder **tree) {
 
     struct stat sb;
+    struct usage usage = {0, 0};
+    struct usage own;
+    const struct usage *own_known = NULL;
 
+    *tree = NULL;
+    error_count = 0;
     if (lstat(path, &sb) == 0) {
         if (S_ISREG(sb.st_mode)) { // if it's a file, not a directory (base case)
-            return sb.st_size;
+            usage.apparent = sb.st_size;
+            usage.allocated = (uint64_t) sb.st_blocks * 512;
+            return usage;
+        }
+        // The folder's own size is known now, scan_folder() doesn't have to stat it again. A symbolic link to a
+        // folder is followed, and the folder is stat'ed by scan_folder().
+        if (S_ISDIR(sb.st_mode)) {
+            own.apparent = sb.st_size;
+            own.allocated = (uint64_t) sb.st_blocks * 512;
+            own_known = &own;
         }
     } else {
         perror("LSTAT ERROR\n");
     }
 
-    DIR *folder = opendir(path);
-
-    if (folder == NULL) {
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
         perror("OPENDIR ERROR");
-        return 0;
+        error_count++;
+        if (own_known != NULL) {
+            usage = own;
+        }
+        return usage;
+    }
+    struct folder *root = folder_new(NULL, path);
+    if (root == NULL) {
+        perror("MALLOC ERROR");
+        error_count++;
+        close(fd);
+        return usage;
     }
 
-    struct dirent *element;
-    size_t size = 4096; // bytes of the folder itself
+    folder_apparent_total = 0;
+    folder_allocated_total = 0;
+    open_folders = 1; // the top folder's
+    queued_tasks = 0;
+    pending_folders = NULL;
 
+    // The taskgroup waits for the tasks of all sub-folders, however deep, and then adds up their copies
+    // of the totals. No folder has to wait for its own sub-folders (no taskwait).
+#pragma omp taskgroup task_reduction(+:folder_apparent_total, folder_allocated_total)
+    {
+        STAT_BUSY_START(busy_start);
+        usage = scan_folder(fd, root, own_known);
+        folder_add(root, usage);
+        release_open_folder(); // opens the sub-folders still pending, their tasks are part of the taskgroup
+        STAT_BUSY_END(busy_start);
+    }
 
-    for (element = readdir(folder); element != NULL; element = readdir(folder)) {
+    usage.apparent += folder_apparent_total;
+    usage.allocated += folder_allocated_total;
+    if (keep_tree) {
+        *tree = root;
+    }
+    folder_release(root);
+    return usage;
+}
 
-        {
-            long path_length = sizeof(char) * (strlen(path) + strlen(element->d_name) + 2);
-            char *name = (char *) malloc(path_length);
-            strcpy(name, path);
-            strcpy(name + strlen(path), "/");
-            strcpy(name + strlen(path) + 1, element->d_name);
-
-            // if directory
-            if (element->d_type == DT_DIR) {
-                if (strcmp(element->d_name, ".") != 0 && strcmp(element->d_name, "..") != 0) { // compares the string pointed to, by str1 to the string pointed to by str2
-                    // Copying the path name ensures that the task receives a copy of the name.
-                    // The task needs the path name to exist until it got executed
-                    char *priv_name = strdup(name); // duplicate of the string
-
-                    // The task needs to remember the current value of priv_name as it will change in the next loop
-                    // iteration --> firstprivate. size will need to be modified --> shared.
-#pragma omp task shared(size) firstprivate(priv_name)
-                    {
-                        // as all tasks will write to the variable size, the writing operations should be atomic
-#pragma omp atomic update
-                        // recursive call of calculate_folder_size
-                        size += calculate_folder_size(priv_name);
+/**
+ * @return the size of the folder that is shown and sorted by: allocated or apparent
+ */
+static uint64_t folder_key(const struct folder *folder, int allocated) {
+    return allocated ? folder->total.allocated : folder->total.apparent;
+}
+
+// Folders of the tree in a selection, with the key they are sorted by
+struct folder_list {
+    struct folder **folders;
+    size_t count;
+    size_t capacity;
+};
+
+// qsort() can't take the key as an argument
+static int sort_allocated = 0;
+
+/**
+ * Compares folders by descending size, then by ascending depth, so that ties keep parents before children.
+ */
+static int compare_folders(const void *a, const void *b) {
+    const struct folder *x = *(const struct folder *const *) a;
+    const struct folder *y = *(const struct folder *const *) b;
+    uint64_t kx = folder_key(x, sort_allocated);
+    uint64_t ky = folder_key(y, sort_allocated);
+    if (kx != ky) {
+        return kx < ky ? 1 : -1;
+    }
+    return (x->depth > y->depth) - (x->depth < y->depth);
+}
+
+/**
+ * Moves the folder at index i down the min-heap of folders (smallest key at index 0).
+ */
+static void heap_sift_down(struct folder **heap, size_t count, size_t i, int allocated) {
+    for (;;) {
+        size_t smallest = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+        if (left < count && folder_key(heap[left], allocated) < folder_key(heap[smallest], allocated)) {
+            smallest = left;
+        }
+        if (right < count && folder_key(heap[right], allocated) < folder_key(heap[smallest], allocated)) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+        struct folder *tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+/**
+ * Walks the tree (with an explicit stack, trees can be deep) and selects the folders up to max_depth, sorted by
+ * descending size, and the top largest folders below the root, with a min-heap of size top.
+ * @param root = the folder tree
+ * @param max_depth = deepest folders to list, -1 for none
+ * @param top = number of largest folders to select
+ * @param allocated = sort by allocated instead of apparent size
+ * @param listed = set to the folders up to max_depth
+ * @param largest = set to the largest folders
+ * @return 0 on success, -1 if memory ran out
+ */
+static int select_folders(struct folder *root, int max_depth, size_t top, int allocated,
+                          struct folder_list *listed, struct folder_list *largest) {
+    struct folder_list stack = {NULL, 0, 0};
+    listed->count = 0;
+    largest->count = 0;
+    largest->capacity = top;
+    largest->folders = top > 0 ? (struct folder **) malloc(top * sizeof(struct folder *)) : NULL;
+    if (top > 0 && largest->folders == NULL) {
+        return -1;
+    }
 
-                        // No longer needed.
-                        free(priv_name);
+    struct folder *folder = root;
+    for (;;) {
+        if (folder->depth <= max_depth) {
+            if (listed->count == listed->capacity) {
+                size_t capacity = listed->capacity > 0 ? 2 * listed->capacity : 64;
+                struct folder **folders = (struct folder **) realloc(listed->folders,
+                                                                     capacity * sizeof(struct folder *));
+                if (folders == NULL) {
+                    free(stack.folders);
+                    return -1;
+                }
+                listed->folders = folders;
+                listed->capacity = capacity;
+            }
+            listed->folders[listed->count++] = folder;
+        }
+        if (folder != root && top > 0) {
+            if (largest->count < top) {
+                largest->folders[largest->count++] = folder;
+                if (largest->count == top) {
+                    for (size_t i = top / 2; i-- > 0;) {
+                        heap_sift_down(largest->folders, top, i, allocated);
                     }
                 }
-            } else {
+            } else if (folder_key(folder, allocated) > folder_key(largest->folders[0], allocated)) {
+                largest->folders[0] = folder;
+                heap_sift_down(largest->folders, top, 0, allocated);
+            }
+        }
 
-                int status = lstat(name, &sb);
-                if (status == 0) {
-                    size += sb.st_size;
-                } else {
-                    perror("LSTAT ERROR\n");
+        for (struct folder *child = folder->first_child; child != NULL; child = child->next_sibling) {
+            if (stack.count == stack.capacity) {
+                size_t capacity = stack.capacity > 0 ? 2 * stack.capacity : 64;
+                struct folder **folders = (struct folder **) realloc(stack.folders,
+                                                                     capacity * sizeof(struct folder *));
+                if (folders == NULL) {
+                    free(stack.folders);
+                    return -1;
                 }
+                stack.folders = folders;
+                stack.capacity = capacity;
             }
-            free(name);
+            stack.folders[stack.count++] = child;
         }
+        if (stack.count == 0) {
+            break;
+        }
+        folder = stack.folders[--stack.count];
     }
-// Parent tasks waits for all children to finish before returning the result
-#pragma omp taskwait
-    closedir(folder);
+    free(stack.folders);
+
+    sort_allocated = allocated;
+    if (listed->count > 0) {
+        qsort(listed->folders, listed->count, sizeof(struct folder *), compare_folders);
+    }
+    if (largest->count > 0) {
+        qsort(largest->folders, largest->count, sizeof(struct folder *), compare_folders);
+    }
+    return 0;
+}
+
+/**
+ * Prints s as a JSON string, with quotes.
+ */
+static void print_json_string(const char *s) {
+    putchar('"');
+    for (const unsigned char *c = (const unsigned char *) s; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            printf("\\%c", *c);
+        } else if (*c < 0x20) {
+            printf("\\u%04x", *c);
+        } else {
+            putchar(*c);
+        }
+    }
+    putchar('"');
+}
+
+/**
+ * Prints the folders of a selection as a JSON array of {"path", "apparent", "allocated"} objects.
+ */
+static void print_json_folders(const char *name, const struct folder_list *list) {
+    printf(",\n  \"%s\": [", name);
+    for (size_t i = 0; i < list->count; i++) {
+        char *path = folder_path(list->folders[i], NULL);
+        printf("%s\n    {\"path\": ", i > 0 ? "," : "");
+        print_json_string(path != NULL ? path : list->folders[i]->name);
+        printf(", \"apparent\": %" PRIu64 ", \"allocated\": %" PRIu64 "}", list->folders[i]->total.apparent,
+               list->folders[i]->total.allocated);
+        free(path);
+    }
+    printf("%s]", list->count > 0 ? "\n  " : "");
+}
 
-    return size;
+/**
+ * Prints the folders of a selection as "<size>\t<path>" lines.
+ */
+static void print_text_folders(const struct folder_list *list, int allocated) {
+    for (size_t i = 0; i < list->count; i++) {
+        char *path = folder_path(list->folders[i], NULL);
+        printf("%" PRIu64 "\t%s\n", folder_key(list->folders[i], allocated),
+               path != NULL ? path : list->folders[i]->name);
+        free(path);
+    }
+}
+
+
+/**
+ * Sets max_open_folders and max_queued_tasks. All folders together get RLIMIT_NOFILE, less OTHER_DESCRIPTORS and one io_uring
+ * descriptor per thread, which are left aside before any ring is set up.
+ * @param max_open = descriptors folders may hold (--max-open), 0 for all of the folders' share
+ * @param max_tasks = sub-folder tasks that may be queued (--max-tasks), 0 for MAX_TASKS_PER_THREAD per thread
+ */
+static void folder_limits(int max_open, int max_tasks) {
+    struct rlimit limit;
+    int total = 1024;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        rlim_t cur = limit.rlim_cur == RLIM_INFINITY ? (rlim_t) 1 << 21 : limit.rlim_cur;
+        total = cur > (rlim_t) INT32_MAX ? INT32_MAX : (int) cur;
+    }
+    total -= OTHER_DESCRIPTORS;
+#ifdef __linux__
+    if (use_uring) {
+        total -= omp_get_max_threads();
+    }
+#endif
+    if (total < 1) {
+        total = 1;
+    }
+
+    if (max_open == 0 || max_open > total) {
+        max_open = total;
+    }
+    if (max_tasks == 0) {
+        max_tasks = MAX_TASKS_PER_THREAD * omp_get_max_threads();
+    }
+    max_open_folders = max_open;
+    max_queued_tasks = max_tasks;
+}
+
+#ifdef FOLDER_SIZE_STATS
+/**
+ * Prints the statistics of the traversal to stderr, as text or as one JSON object, and sets them back to zero.
+ * @param threads = size of the team
+ * @param wall = elapsed time of the traversal
+ * @param before = resource usage before the traversal, for the user and system time
+ */
+static void print_stats(int json, int threads, double wall, const struct rusage *before) {
+    fflush(stdout); // after the results, if both go to the terminal
+    struct rusage after;
+    getrusage(RUSAGE_SELF, &after);
+    double user = (double) (after.ru_utime.tv_sec - before->ru_utime.tv_sec) +
+                  (double) (after.ru_utime.tv_usec - before->ru_utime.tv_usec) / 1e6;
+    double system = (double) (after.ru_stime.tv_sec - before->ru_stime.tv_sec) +
+                    (double) (after.ru_stime.tv_usec - before->ru_stime.tv_usec) / 1e6;
+
+    struct walk_stats sum;
+    memset(&sum, 0, sizeof(sum));
+    for (int t = 0; t < STATS_THREADS; t++) {
+        sum.folders += walk_stats[t].folders;
+        sum.cached_folders += walk_stats[t].cached_folders;
+        sum.files += walk_stats[t].files;
+        sum.stat_calls += walk_stats[t].stat_calls;
+        sum.open_calls += walk_stats[t].open_calls;
+        sum.getdents_calls += walk_stats[t].getdents_calls;
+        sum.uring_requests += walk_stats[t].uring_requests;
+        sum.uring_enters += walk_stats[t].uring_enters;
+        sum.tasks += walk_stats[t].tasks;
+        sum.inline_folders += walk_stats[t].inline_folders;
+        sum.pending_folders += walk_stats[t].pending_folders;
+        sum.chunk_tasks += walk_stats[t].chunk_tasks;
+        sum.busy_seconds += walk_stats[t].busy_seconds;
+    }
+    if (threads > STATS_THREADS) {
+        threads = STATS_THREADS;
+    }
+
+    if (json) {
+        fprintf(stderr, "{\"folders\": %" PRIu64 ", \"cached_folders\": %" PRIu64 ", \"files\": %" PRIu64
+                ", \"stat_calls\": %" PRIu64 ", \"open_calls\": %" PRIu64 ", \"getdents_calls\": %" PRIu64
+                ", \"uring_requests\": %" PRIu64 ", \"uring_enters\": %" PRIu64 ", \"tasks\": %" PRIu64
+                ", \"inline_folders\": %" PRIu64 ", \"pending_folders\": %" PRIu64 ", \"chunk_tasks\": %" PRIu64
+                ", \"errors\": %d, \"wall_seconds\": %.6f, \"user_seconds\": %.6f, \"system_seconds\": %.6f"
+                ", \"threads\": [",
+                sum.folders, sum.cached_folders, sum.files, sum.stat_calls, sum.open_calls, sum.getdents_calls,
+                sum.uring_requests, sum.uring_enters, sum.tasks, sum.inline_folders, sum.pending_folders,
+                sum.chunk_tasks, error_count, wall, user, system);
+        for (int t = 0; t < threads; t++) {
+            fprintf(stderr, "%s{\"busy_seconds\": %.6f, \"idle_seconds\": %.6f}", t > 0 ? ", " : "",
+                    walk_stats[t].busy_seconds, wall - walk_stats[t].busy_seconds);
+        }
+        fprintf(stderr, "]}\n");
+    } else {
+        fprintf(stderr, "folders: %" PRIu64 " (%" PRIu64 " cached), files: %" PRIu64 "\n", sum.folders,
+                sum.cached_folders, sum.files);
+        fprintf(stderr, "calls: %" PRIu64 " stat, %" PRIu64 " open, %" PRIu64 " getdents, %" PRIu64
+                " through io_uring in %" PRIu64 " io_uring_enter\n", sum.stat_calls, sum.open_calls,
+                sum.getdents_calls, sum.uring_requests, sum.uring_enters);
+        fprintf(stderr, "tasks: %" PRIu64 " folders, %" PRIu64 " folders scanned inline, %" PRIu64
+                " opened later by path, %" PRIu64 " chunks\n", sum.tasks, sum.inline_folders, sum.pending_folders,
+                sum.chunk_tasks);
+        fprintf(stderr, "time: %2.4f seconds wall, %2.4f user, %2.4f system\n", wall, user, system);
+        for (int t = 0; t < threads; t++) {
+            fprintf(stderr, "thread %d: %2.4f seconds busy, %2.4f idle\n", t, walk_stats[t].busy_seconds,
+                    wall - walk_stats[t].busy_seconds);
+        }
+    }
+    memset(walk_stats, 0, sizeof(walk_stats));
+}
+#endif
+
+// What to print after a traversal, from the command line
+struct output {
+    int allocated; // also the allocated size, and sort by it
+    int json;
+    int max_depth; // -1 if no folders are listed by depth
+    long top;
+};
+
+/**
+ * Prints the result of a traversal of path.
+ * @param tree = the folder tree, or NULL
+ */
+static void print_results(const struct output *output, const char *path, struct usage folder_size,
+                          struct folder *tree, double elapsed) {
+    struct folder_list listed = {NULL, 0, 0};
+    struct folder_list largest = {NULL, 0, 0};
+    if (tree != NULL &&
+        select_folders(tree, output->max_depth, (size_t) output->top, output->allocated, &listed, &largest) != 0) {
+        perror("MALLOC ERROR");
+    }
+
+    if (output->json) {
+        printf("{\n  \"path\": ");
+        print_json_string(path);
+        printf(",\n  \"apparent\": %" PRIu64 ",\n  \"allocated\": %" PRIu64 ",\n  \"elapsed\": %.6f,\n  \"errors\": %d",
+               folder_size.apparent, folder_size.allocated, elapsed, error_count);
+        print_json_folders("folders", &listed);
+        print_json_folders("top", &largest);
+        printf("\n}\n");
+    } else {
+        print_text_folders(&listed, output->allocated);
+        if (output->top > 0) {
+            printf("Largest %ld folders:\n", output->top);
+            print_text_folders(&largest, output->allocated);
+        }
+        if (output->allocated) {
+            printf("Size: %" PRIu64 ", Allocated: %" PRIu64 ", Elapsed time: %2.2f seconds\n", folder_size.apparent,
+                   folder_size.allocated, elapsed);
+        } else {
+            printf("Size: %" PRIu64 ", Elapsed time: %2.2f seconds\n", folder_size.apparent, elapsed);
+        }
+        if (error_count > 0) {
+            printf("%d errors, some bytes were not counted.\n", error_count);
+        }
+    }
+    free(listed.folders);
+    free(largest.folders);
 }
 
 
@@ -88,11 +2087,117 @@ int main(int argc, char **argv) {
 
     double start_time = omp_get_wtime();
 
-    if (argc != 2) {
-        printf("Usage: testprog <dirname>\n");
+    static const struct option long_options[] = {
+        {"allocated", no_argument, NULL, 'a'},
+        {"cache", required_argument, NULL, 'c'},
+        {"count-links", no_argument, NULL, 'l'},
+        {"depth", required_argument, NULL, 'd'},
+        {"json", no_argument, NULL, 'j'},
+        {"max-open", required_argument, NULL, 'm'},
+        {"max-tasks", required_argument, NULL, 't'},
+        {"stats", optional_argument, NULL, 's'},
+        {"top", required_argument, NULL, 'n'},
+        {"uring", no_argument, NULL, 'u'},
+        {"watch", required_argument, NULL, 'w'},
+        {NULL, 0, NULL, 0},
+    };
+    static const char *usage_text = "Usage: testprog [--allocated] [--count-links] [--uring] [--depth N] [--top N] "
+                                    "[--json] [--cache FILE] [--watch SECONDS] [--max-open N] [--max-tasks N] "
+                                    "[--stats[=text|json]] <dirname>\n";
+    struct output output = {0, 0, -1, 0};
+    const char *cache_path = NULL;
+    int watch = 0;
+    int max_open = 0;
+    int max_tasks = 0;
+    int stats = -1; // -1: no statistics, 0: as text, 1: as JSON
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "ac:d:jlm:n:s::t:uw:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'a':
+                output.allocated = 1;
+                break;
+            case 'c':
+                cache_path = optarg;
+                use_cache = 1;
+                break;
+            case 'd':
+                output.max_depth = atoi(optarg);
+                if (output.max_depth < 0) {
+                    printf("%s", usage_text);
+                    return EXIT_FAILURE;
+                }
+                keep_tree = 1;
+                break;
+            case 'j':
+                output.json = 1;
+                keep_tree = 1;
+                break;
+            case 'l':
+                count_links = 1;
+                break;
+            case 'm':
+                max_open = atoi(optarg);
+                if (max_open <= 0) {
+                    printf("%s", usage_text);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'n':
+                output.top = atol(optarg);
+                if (output.top < 0) {
+                    printf("%s", usage_text);
+                    return EXIT_FAILURE;
+                }
+                keep_tree = 1;
+                break;
+            case 's':
+#ifdef FOLDER_SIZE_STATS
+                if (optarg == NULL || strcmp(optarg, "text") == 0) {
+                    stats = 0;
+                } else if (strcmp(optarg, "json") == 0) {
+                    stats = 1;
+                } else {
+                    printf("%s", usage_text);
+                    return EXIT_FAILURE;
+                }
+#else
+                printf("--stats needs a build with -DFOLDER_SIZE_STATS.\n");
+                return EXIT_FAILURE;
+#endif
+                break;
+            case 't':
+                max_tasks = atoi(optarg);
+                if (max_tasks <= 0) {
+                    printf("%s", usage_text);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'u':
+#ifdef __linux__
+                use_uring = 1;
+#else
+                printf("io_uring is only available on Linux, using fstatat() and openat().\n");
+#endif
+                break;
+            case 'w':
+                watch = atoi(optarg);
+                if (watch <= 0) {
+                    printf("%s", usage_text);
+                    return EXIT_FAILURE;
+                }
+                use_cache = 1;
+                break;
+            default:
+                printf("%s", usage_text);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind + 1 != argc) {
+        printf("%s", usage_text);
         return EXIT_FAILURE;
     }
-    char *str = argv[1];
+    char *str = argv[optind];
 
     struct stat sb;
     int error = stat(str, &sb);
@@ -110,21 +2215,90 @@ int main(int argc, char **argv) {
             printf("A component of the path is not a directory.\n");
             break;
         default:
-            printf("Path ok.\n");
+            if (!output.json) {
+                printf("Path ok.\n");
+            }
     }
-    int folder_size;
 
-#pragma omp parallel shared(str)
-    {
-        // causing the function to be called only once, and not by every thread
-#pragma omp single
-        {
-            folder_size = calculate_folder_size(str);
+    folder_limits(max_open, max_tasks);
+    omp_init_lock(&pending_lock);
+    if (cache_path != NULL) {
+        cache_load(cache_path);
+    }
+    if (watch > 0) {
+#ifdef __linux__
+        watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (watch_fd < 0) {
+            perror("INOTIFY ERROR, files changed in place are not noticed");
         }
+#else
+        printf("inotify is only available on Linux, files changed in place are not noticed.\n");
+#endif
     }
 
-    double end_time = omp_get_wtime();
-    printf("Size: %d, Elapsed time: %2.2f seconds\n", folder_size, end_time - start_time);
+    // With --watch, the folder is traversed again every watch seconds, each time with the cache of the last one
+    for (;;) {
+        struct usage folder_size;
+        struct folder *tree = NULL;
+        int threads = 1;
+        cache_not_after = time(NULL);
+        link_set_init();
+#ifdef FOLDER_SIZE_STATS
+        struct rusage usage_before;
+        getrusage(RUSAGE_SELF, &usage_before);
+        double traversal_start = omp_get_wtime();
+#endif
+
+#pragma omp parallel shared(str, threads)
+        {
+            // causing the function to be called only once, and not by every thread
+#pragma omp single
+            {
+                threads = omp_get_num_threads();
+                folder_size = calculate_folder_size(str, &tree);
+            }
+        }
+#ifdef FOLDER_SIZE_STATS
+        double traversal_time = omp_get_wtime() - traversal_start;
+#endif
+
+        link_set_free();
+        if (use_cache) {
+            cache_finish();
+        }
+        double end_time = omp_get_wtime();
+
+        print_results(&output, str, folder_size, tree, end_time - start_time);
+#ifdef FOLDER_SIZE_STATS
+        if (stats >= 0) {
+            print_stats(stats, threads, traversal_time, &usage_before);
+        }
+#else
+        (void) stats;
+        (void) threads;
+#endif
+        arena_free();
+        if (cache_path != NULL) {
+            cache_save(cache_path);
+        }
+        if (watch <= 0) {
+            break;
+        }
+
+        fflush(stdout);
+#ifdef __linux__
+        if (watch_fd >= 0) {
+            watch_wait(watch);
+        } else {
+            sleep((unsigned) watch);
+        }
+#else
+        sleep((unsigned) watch);
+#endif
+        traversal++;
+        start_time = omp_get_wtime();
+    }
+    cache_clear();
 }
 
 // Some input from stackoverflow user hristo-iliev
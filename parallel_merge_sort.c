@@ -1,298 +1,1019 @@
 #include <errno.h>
+#include <getopt.h>
 #include <omp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <assert.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-/****************************************************************************************************
-Parallel merge sort:
+#include "parallel_merge_sort.h"
+#include "parallel_merge_sort_simd.h"
+#include "parallel_merge_sort_stats.h"
+#include "parallel_merge_sort_external.h"
 
- The array is split into sub-arrays until each sub-array only holds one element. This way, all 
- sub-arrays are sorted (since they only have 1 element). Then, all sub-array are merged with their 
- "neighbouring" sub-array, and so on, until all are merged to one array.
+// SIMD kernel for the leaves of the int32 sort, selected on the first call (see parallel_merge_sort_simd.h)
+static simd_leaf_fn leaf_sort_int32 = NULL;
+static int leaf_sort_int32_selected = 0;
 
- Therefore, when starting the merge operation we have a very large number of very small arrays.
- Merging them requires very little CPU time. That's why it makes sense to merge them sequentially 
- up to a certain array length (2000 - found by trying out different numbers), in order to avoid 
- the overheads of parallelism. Once the arrays have reached this certain size, the operation takes 
- much more time and it becomes reasonable to parallelize it.
+static void select_leaf_kernels(void)
+{
+#pragma omp critical(merge_sort_leaf_kernels)
+    {
+        if (!leaf_sort_int32_selected)
+        {
+            leaf_sort_int32 = simd_select_leaf();
+            leaf_sort_int32_selected = 1;
+        }
+    }
+}
 
- ****************************************************************************************************/
+/**
+ * @brief Order-preserving mappings of the key types to unsigned integers, for the radix sort. Signed
+ * integers get their sign bit flipped. Floats are ordered like their bits for positive numbers, and
+ * in reverse for negative ones, so negative numbers have all bits flipped and positive ones only
+ * the sign bit. -0.0 gets the key of 0.0, since the merge sort compares them as equal and keeps their
+ * order, and the result must not depend on which of the sorts is used. NaNs are not supported (see
+ * parallel_merge_sort.h), like in the comparisons of the merge sort.
+ */
+static inline uint32_t radix_key_float(float x)
+{
+    uint32_t bits = 0;
+    if (x != 0.0f)
+        memcpy(&bits, &x, sizeof(bits));
+    return bits & UINT32_C(0x80000000) ? ~bits : bits | UINT32_C(0x80000000);
+}
+
+static inline uint64_t radix_key_double(double x)
+{
+    uint64_t bits = 0;
+    if (x != 0.0)
+        memcpy(&bits, &x, sizeof(bits));
+    return bits & UINT64_C(0x8000000000000000) ? ~bits : bits | UINT64_C(0x8000000000000000);
+}
 
+#define RADIX_KEY_INT32(x) ((uint32_t) (x) ^ UINT32_C(0x80000000))
+#define RADIX_KEY_INT64(x) ((uint64_t) (x) ^ UINT64_C(0x8000000000000000))
+
+// Instantiate the sort for every supported element type (see parallel_merge_sort_impl.h)
+#define SORT_NAME int32
+#define SORT_KEY_T int32_t
+#define SORT_RADIX_T uint32_t
+#define SORT_RADIX_KEY(x) RADIX_KEY_INT32(x)
+#define SORT_LEAF_MAX SIMD_LEAF_MAX
+#define SORT_LEAF(a, first, count) (leaf_sort_int32 != NULL && (leaf_sort_int32((a) + (first), (count)), 1))
+#include "parallel_merge_sort_impl.h"
+
+#define SORT_NAME int64
+#define SORT_KEY_T int64_t
+#define SORT_RADIX_T uint64_t
+#define SORT_RADIX_KEY(x) RADIX_KEY_INT64(x)
+#include "parallel_merge_sort_impl.h"
+
+#define SORT_NAME uint64
+#define SORT_KEY_T uint64_t
+#define SORT_RADIX_T uint64_t
+#define SORT_RADIX_KEY(x) (x)
+#include "parallel_merge_sort_impl.h"
+
+#define SORT_NAME float
+#define SORT_KEY_T float
+#define SORT_RADIX_T uint32_t
+#define SORT_RADIX_KEY(x) radix_key_float(x)
+#include "parallel_merge_sort_impl.h"
+
+#define SORT_NAME double
+#define SORT_KEY_T double
+#define SORT_RADIX_T uint64_t
+#define SORT_RADIX_KEY(x) radix_key_double(x)
+#include "parallel_merge_sort_impl.h"
+
+#define SORT_NAME int32_kv
+#define SORT_KEY_T int32_t
+#define SORT_RADIX_T uint32_t
+#define SORT_RADIX_KEY(x) RADIX_KEY_INT32(x)
+#define SORT_PAYLOAD_T uint64_t
+#include "parallel_merge_sort_impl.h"
+
+#define SORT_NAME int64_kv
+#define SORT_KEY_T int64_t
+#define SORT_RADIX_T uint64_t
+#define SORT_RADIX_KEY(x) RADIX_KEY_INT64(x)
+#define SORT_PAYLOAD_T uint64_t
+#include "parallel_merge_sort_impl.h"
+
+#define SORT_NAME uint64_kv
+#define SORT_KEY_T uint64_t
+#define SORT_RADIX_T uint64_t
+#define SORT_RADIX_KEY(x) (x)
+#define SORT_PAYLOAD_T uint64_t
+#include "parallel_merge_sort_impl.h"
+
+#define SORT_NAME float_kv
+#define SORT_KEY_T float
+#define SORT_RADIX_T uint32_t
+#define SORT_RADIX_KEY(x) radix_key_float(x)
+#define SORT_PAYLOAD_T uint64_t
+#include "parallel_merge_sort_impl.h"
+
+#define SORT_NAME double_kv
+#define SORT_KEY_T double
+#define SORT_RADIX_T uint64_t
+#define SORT_RADIX_KEY(x) radix_key_double(x)
+#define SORT_PAYLOAD_T uint64_t
+#include "parallel_merge_sort_impl.h"
+
+#define SORT_NAME generic
+#define SORT_GENERIC
+#include "parallel_merge_sort_impl.h"
+
+/******************************************** cutoff ********************************************/
+
+// Smallest cutoff that is accepted
+#define MIN_CUTOFF 16
+
+// Cutoffs tried by merge_sort_calibrate_cutoff(), on a sample of CALIBRATION_SAMPLE random keys
+static const size_t calibration_cutoffs[] = {500, 1000, 2000, 4000, 8000, 16000, 32000};
+#define CALIBRATION_SAMPLE (1 << 21)
+#define CALIBRATION_ROUNDS 2
+
+// Result of the last calibration in this process
+static size_t calibrated_cutoff = 0;
+static int calibrated_threads = 0;
 
 /**
- * @brief Parallel function to merge to sub-arrays (arr[left..mid] and arr[mid+1..right])
- * @param: arr
- * @param: left = index of the left end
- * @param: left = index of the middle of the array
- * @param: left = index of the right end
+ * @brief Path of the file the calibrated cutoffs are cached in: $MERGE_SORT_CUTOFF_CACHE, else
+ * $XDG_CACHE_HOME/parallel_merge_sort_cutoff, else ~/.cache/parallel_merge_sort_cutoff.
+ * @return 0 on success, -1 if there is no place for it
  */
-void merge_parallel(int arr[], int left, int mid, int right)
+static int cutoff_cache_path(char *path, size_t len)
 {
+    const char *file = getenv("MERGE_SORT_CUTOFF_CACHE");
+    const char *dir = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    int written;
+
+    if (file != NULL && *file != '\0')
+        written = snprintf(path, len, "%s", file);
+    else if (dir != NULL && *dir != '\0')
+        written = snprintf(path, len, "%s/parallel_merge_sort_cutoff", dir);
+    else if (home != NULL && *home != '\0')
+    {
+        // ~/.cache might not exist yet
+        char cache_dir[4096];
+        snprintf(cache_dir, sizeof(cache_dir), "%s/.cache", home);
+        mkdir(cache_dir, 0755);
+        written = snprintf(path, len, "%s/.cache/parallel_merge_sort_cutoff", home);
+    } else
+        return -1;
+
+    return written > 0 && (size_t) written < len ? 0 : -1;
+}
 
-    int i, j, k;
-    int n1 = mid - left + 1;
-    int n2 = right - mid;
-
-    // temp arrays
-    int32_t *L;
-    L = (int32_t *) calloc(n1, sizeof(int32_t));
+/**
+ * @brief Looks up the cached cutoff for this host and thread count. The cache has one
+ * "<hostname> <threads> <cutoff>" line per entry.
+ * @return the cutoff, or 0 if there is none
+ */
+static size_t read_cached_cutoff(const char *path, const char *host, int nthreads)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return 0;
 
-    int32_t *R;
-    R = (int32_t *) calloc(n2, sizeof(int32_t));
+    char entry_host[256];
+    int entry_threads;
+    size_t entry_cutoff;
+    size_t cutoff = 0;
 
-    // Copy data to temp arrays L[] and R[]
-#pragma omp parallel shared(i, j, k, n1, n2)
+    while (fscanf(file, "%255s %d %zu", entry_host, &entry_threads, &entry_cutoff) == 3)
     {
-#pragma omp for
-        for (i = 0; i < n1; i++)
-            L[i] = arr[left + i];
-
-#pragma omp for
-        for (j = 0; j < n2; j++)
-            R[j] = arr[mid + 1 + j];
+        if (strcmp(entry_host, host) == 0 && entry_threads == nthreads)
+            cutoff = entry_cutoff;  // the last entry wins
     }
+    fclose(file);
+    return cutoff;
+}
 
-    // Merge the temp arrays back into arr[l..r]
+size_t merge_sort_calibrate_cutoff(int nthreads)
+{
+    if (nthreads <= 0)
+        nthreads = omp_get_max_threads();
 
-    i = 0;      // Initial index of first subarray
-    j = 0;      // Initial index of second subarray
-    k = left;   // Initial index of merged subarray
+    size_t best = 0;
 
-    while (i < n1 && j < n2)
+#pragma omp critical(merge_sort_calibration)
     {
-        if (L[i] <= R[j])
-        {
-            arr[k] = L[i];
-            i++;
-        } else
+        if (calibrated_cutoff != 0 && calibrated_threads == nthreads)
+            best = calibrated_cutoff;
+
+        char host[256] = "unknown";
+        char path[4096];
+        int have_cache = cutoff_cache_path(path, sizeof(path)) == 0;
+        gethostname(host, sizeof(host) - 1);
+        host[sizeof(host) - 1] = '\0';
+
+        if (best == 0 && have_cache)
+            best = read_cached_cutoff(path, host, nthreads);
+
+        int32_t *sample = best == 0 ? (int32_t *) malloc(CALIBRATION_SAMPLE * sizeof(int32_t)) : NULL;
+        int32_t *arr = best == 0 ? (int32_t *) malloc(CALIBRATION_SAMPLE * sizeof(int32_t)) : NULL;
+
+        if (sample != NULL && arr != NULL)
         {
-            arr[k] = R[j];
-            j++;
+            unsigned int seed = 0;
+            for (size_t i = 0; i < CALIBRATION_SAMPLE; i++)
+                sample[i] = rand_r(&seed);
+
+            // Time every candidate, keep the fastest of a few rounds per candidate
+            double best_time = 0.0;
+            for (size_t c = 0; c < sizeof(calibration_cutoffs) / sizeof(calibration_cutoffs[0]); c++)
+            {
+                struct merge_sort_options opts = {.nthreads = nthreads, .cutoff = calibration_cutoffs[c],
+                                                  .algorithm = MERGE_SORT_MERGE, .adaptive = MERGE_SORT_ADAPTIVE_OFF};
+                double time = 0.0;
+
+                for (int round = 0; round < CALIBRATION_ROUNDS; round++)
+                {
+                    memcpy(arr, sample, CALIBRATION_SAMPLE * sizeof(int32_t));
+                    double start_time = omp_get_wtime();
+                    parallel_merge_sort_opts(arr, CALIBRATION_SAMPLE, &opts);
+                    double elapsed = omp_get_wtime() - start_time;
+                    if (round == 0 || elapsed < time)
+                        time = elapsed;
+                }
+                if (best == 0 || time < best_time)
+                {
+                    best = calibration_cutoffs[c];
+                    best_time = time;
+                }
+            }
+
+            FILE *file = have_cache ? fopen(path, "a") : NULL;
+            if (file != NULL)
+            {
+                fprintf(file, "%s %d %zu\n", host, nthreads, best);
+                fclose(file);
+            }
         }
-        k++;
-    }
+        free(sample);
+        free(arr);
 
-    // Copy the remaining elements of L[], if there are any
-    while (i < n1)
-    {
-        arr[k] = L[i];
-        i++;
-        k++;
+        if (best == 0)
+            best = SEQUENTIAL_CUTOFF;
+
+        calibrated_cutoff = best;
+        calibrated_threads = nthreads;
     }
+    return best;
+}
 
-    // Copy the remaining elements of R[], if there are any
-    while (j < n2)
+static size_t merge_sort_resolve_cutoff(size_t requested, int nthreads)
+{
+    if (requested == 0)
     {
-        arr[k] = R[j];
-        j++;
-        k++;
+        const char *env = getenv("MERGE_SORT_CUTOFF");
+
+        if (env != NULL && strcmp(env, "auto") == 0)
+            requested = MERGE_SORT_CUTOFF_AUTO;
+        else if (env != NULL && *env != '\0')
+        {
+            char *endptr;
+            unsigned long long value = strtoull(env, &endptr, 10);
+            if (*endptr == '\0')
+                requested = (size_t) value;
+        }
+        if (requested == 0)
+            requested = SEQUENTIAL_CUTOFF;
     }
-    free(L);
-    free(R);
+    if (requested == MERGE_SORT_CUTOFF_AUTO)
+        requested = merge_sort_calibrate_cutoff(nthreads);
+
+    return requested < MIN_CUTOFF ? MIN_CUTOFF : requested;
+}
+
+/********************************************* k-way *********************************************/
+
+// kway = 0 gives binary merges. The k-way merge has not been shown to beat them yet, so it is only
+// used when asked for.
+static int merge_sort_resolve_kway(int requested)
+{
+    if (requested < 2)
+        requested = 2;
+    return requested > MAX_KWAY ? MAX_KWAY : requested;
 }
 
+/******************************************* placement ******************************************/
+
+// Number of NUMA nodes, read on first use
+static int numa_nodes = 0;
+
 /**
- * @brief Non-parallel function to merge to sub-arrays (arr[left..mid] and arr[mid+1..right])
- * @param: arr
- * @param: left = index of the left end
- * @param: left = index of the middle of the array
- * @param: left = index of the right end
+ * @brief Counts the NUMA nodes listed in /sys/devices/system/node/online (e.g. "0-1" or "0,2-3").
+ * Machines without that file count as one node.
  */
-void merge_sequential(int arr[], int left, int mid, int right)
+static int merge_sort_numa_nodes(void)
+{
+#pragma omp critical(merge_sort_numa)
+    {
+        if (numa_nodes == 0)
+        {
+            int count = 0;
+            FILE *file = fopen("/sys/devices/system/node/online", "r");
+            if (file != NULL)
+            {
+                int first, last;
+                while (fscanf(file, "%d", &first) == 1)
+                {
+                    last = first;
+                    if (fscanf(file, "-%d", &last) != 1)
+                        last = first;
+                    count += last - first + 1;
+                    if (fgetc(file) != ',')
+                        break;
+                }
+                fclose(file);
+            }
+            numa_nodes = count > 0 ? count : 1;
+        }
+    }
+    return numa_nodes;
+}
+
+void *merge_sort_alloc_local(size_t n, size_t size, int nthreads)
 {
+    if (size != 0 && n > SIZE_MAX / size)
+        return NULL;
+    if (nthreads <= 0)
+        nthreads = omp_get_max_threads();
 
-    int i, j, k;
-    int n1 = mid - left + 1;
-    int n2 = right - mid;
+    // Large allocations are fresh pages that nobody has touched yet, so the first write places them
+    char *arr = (char *) malloc(n * size > 0 ? n * size : 1);
+    if (arr == NULL)
+        return NULL;
 
-    // temp arrays
-    int32_t L[n1];
-    int32_t R[n2];
+#pragma omp parallel num_threads(nthreads) proc_bind(spread)
+    {
+        size_t t = (size_t) omp_get_thread_num();
+        size_t p = (size_t) omp_get_num_threads();
+        size_t begin = block_start(n, p, t);
+        size_t end = block_start(n, p, t + 1);
+        memset(arr + begin * size, 0, (end - begin) * size);
+    }
+    return arr;
+}
 
-    // Copy data to temp arrays L[] and R[]
-    for (i = 0; i < n1; i++)
-        L[i] = arr[left + i];
-    for (j = 0; j < n2; j++)
-        R[j] = arr[mid + 1 + j];
+/******************************************************************************************************/
 
-    // Merge the temp arrays back into arr[l..r]
+// Elements checked between two looks at whether another thread has already failed
+#define VERIFY_CHUNK 65536
 
-    i = 0;      // Initial index of first subarray
-    j = 0;      // Initial index of second subarray
-    k = left;   // Initial index of merged subarray
+/**
+ * @brief Function for checking whether or not an array's elements are ordered. Every thread checks
+ * its own block and the pair that crosses into it from the block before, and stops early once any
+ * thread has found an unsorted pair.
+ * @param: arr
+ * @param: n = length of the array
+ * @param: nthreads = number of threads, 0 for the OpenMP default
+ */
+int is_array_sorted(const int32_t arr[], size_t n, int nthreads)
+{
+    int unsorted = 0;
+    int failed = 0;    // shared, lets the other threads stop early
 
-    while (i < n1 && j < n2)
+#pragma omp parallel num_threads(nthreads > 0 ? nthreads : omp_get_max_threads()) reduction(|:unsorted)
     {
-        if (L[i] <= R[j])
-        {
-            arr[k] = L[i];
-            i++;
-        } else
+        size_t t = (size_t) omp_get_thread_num();
+        size_t p = (size_t) omp_get_num_threads();
+        size_t begin = block_start(n, p, t);
+        size_t end = block_start(n, p, t + 1);
+
+        // The first pair of the block starts in the block before (Equal values allowed)
+        for (size_t i = begin > 0 ? begin : 1; i < end; i += VERIFY_CHUNK)
         {
-            arr[k] = R[j];
-            j++;
+            size_t stop = end - i > VERIFY_CHUNK ? i + VERIFY_CHUNK : end;
+            int found = 0;
+            for (size_t j = i; j < stop; j++)
+                found |= arr[j] < arr[j - 1];
+            if (found)
+            {
+                unsorted = 1;
+#pragma omp atomic write
+                failed = 1;
+            }
+
+            int stop_early;
+#pragma omp atomic read
+            stop_early = failed;
+            if (stop_early)
+                break;
         }
-        k++;
     }
+    return !unsorted;
+}
+
+/**
+ * @brief Order-independent checksum of the keys: the sum of a 64 bit mix of every key. A sorted copy
+ * has the same checksum as the input, so comparing the two confirms that the sort only moved keys
+ * around (up to hash collisions).
+ * @param: arr
+ * @param: n = length of the array
+ * @param: nthreads = number of threads, 0 for the OpenMP default
+ */
+uint64_t array_checksum(const int32_t arr[], size_t n, int nthreads)
+{
+    uint64_t sum = 0;
 
-    // Copy the remaining elements of L[], if there are any
-    while (i < n1)
+#pragma omp parallel for num_threads(nthreads > 0 ? nthreads : omp_get_max_threads()) schedule(static) reduction(+:sum)
+    for (size_t i = 0; i < n; i++)
     {
-        arr[k] = L[i];
-        i++;
-        k++;
+        // splitmix64 finalizer, so that e.g. {1, 4} and {2, 3} do not collide
+        uint64_t x = (uint64_t) (uint32_t) arr[i] + UINT64_C(0x9e3779b97f4a7c15);
+        x = (x ^ (x >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+        x = (x ^ (x >> 27)) * UINT64_C(0x94d049bb133111eb);
+        sum += x ^ (x >> 31);
+    }
+    return sum;
+}
+
+int parallel_merge_sort(int32_t *arr, size_t n, int nthreads)
+{
+    struct merge_sort_options opts = {.nthreads = nthreads};
+    return parallel_merge_sort_opts(arr, n, &opts);
+}
+
+int parallel_merge_sort_opts(int32_t *arr, size_t n, const struct merge_sort_options *opts)
+{
+    select_leaf_kernels();
+    return sort_int32(arr, n, opts);
+}
+
+// The public functions of the other types only differ in the element type
+#define DEFINE_SORT_API(name, type)                                                                 \
+    int parallel_merge_sort_##name(type *arr, size_t n, int nthreads)                               \
+    {                                                                                               \
+        struct merge_sort_options opts = {.nthreads = nthreads};                                    \
+        return sort_##name(arr, n, &opts);                                                          \
+    }                                                                                               \
+    int parallel_merge_sort_##name##_opts(type *arr, size_t n, const struct merge_sort_options *opts) \
+    {                                                                                               \
+        return sort_##name(arr, n, opts);                                                           \
+    }
+
+#define DEFINE_SORT_KV_API(name, type)                                                              \
+    int parallel_merge_sort_##name##_kv(type *keys, uint64_t *values, size_t n, int nthreads)       \
+    {                                                                                               \
+        struct merge_sort_options opts = {.nthreads = nthreads};                                    \
+        sort_array_##name##_kv arr = {keys, values};                                                \
+        return sort_##name##_kv(arr, n, &opts);                                                     \
+    }                                                                                               \
+    int parallel_merge_sort_##name##_kv_opts(type *keys, uint64_t *values, size_t n,                \
+                                             const struct merge_sort_options *opts)                 \
+    {                                                                                               \
+        sort_array_##name##_kv arr = {keys, values};                                                \
+        return sort_##name##_kv(arr, n, opts);                                                      \
     }
 
-    // Copy the remaining elements of R[], if there are any
-    while (j < n2)
+DEFINE_SORT_API(int64, int64_t)
+DEFINE_SORT_API(uint64, uint64_t)
+DEFINE_SORT_API(float, float)
+DEFINE_SORT_API(double, double)
+
+DEFINE_SORT_KV_API(int32, int32_t)
+DEFINE_SORT_KV_API(int64, int64_t)
+DEFINE_SORT_KV_API(uint64, uint64_t)
+DEFINE_SORT_KV_API(float, float)
+DEFINE_SORT_KV_API(double, double)
+
+int parallel_merge_sort_generic(void *base, size_t n, size_t size, int (*compar)(const void *, const void *),
+                                int nthreads)
+{
+    struct merge_sort_options opts = {.nthreads = nthreads};
+    return parallel_merge_sort_generic_opts(base, n, size, compar, &opts);
+}
+
+int parallel_merge_sort_generic_opts(void *base, size_t n, size_t size, int (*compar)(const void *, const void *),
+                                     const struct merge_sort_options *opts)
+{
+    sort_array_generic arr = {(char *) base, size, compar};
+    return sort_generic(arr, n, opts);
+}
+
+int parallel_merge_sort_external(const char *input, const char *output, size_t memory,
+                                 const struct merge_sort_options *opts)
+{
+    return ext_sort_file(input, output, memory, opts);
+}
+
+/******************************************* statistics *****************************************/
+
+int merge_sort_stats_get(struct merge_sort_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+#ifdef MERGE_SORT_STATS
+    for (int t = 0; t < STATS_THREADS; t++)
     {
-        arr[k] = R[j];
-        j++;
-        k++;
+        const struct merge_sort_stats *s = &stats_threads[t].s;
+        stats->sorts += s->sorts;
+        stats->sort_seconds += s->sort_seconds;
+        stats->tasks += s->tasks;
+        stats->copy_seconds += s->copy_seconds;
+        stats->copy_elements += s->copy_elements;
+        stats->leaf_seconds += s->leaf_seconds;
+        stats->leaf_calls += s->leaf_calls;
+        stats->leaf_elements += s->leaf_elements;
+        for (int l = 0; l < MERGE_SORT_STATS_LEVELS; l++)
+        {
+            stats->merge_seconds[l] += s->merge_seconds[l];
+            stats->merge_elements[l] += s->merge_elements[l];
+            stats->merge_chunks[l] += s->merge_chunks[l];
+        }
+        stats->radix_histogram_seconds += s->radix_histogram_seconds;
+        stats->radix_scatter_seconds += s->radix_scatter_seconds;
+        stats->radix_passes += s->radix_passes;
     }
+    return 0;
+#else
+    return -1;
+#endif
 }
 
+void merge_sort_stats_reset(void)
+{
+#ifdef MERGE_SORT_STATS
+    memset(stats_threads, 0, sizeof(stats_threads));
+#endif
+}
+
+#ifndef PARALLEL_MERGE_SORT_NO_MAIN
+
+#include "parallel_merge_sort_io.h"
+
 /**
- * @brief Recursive and sequential merge sort algorithm.
- * @param: arr = array to sort
- * @param: left = index of the left end
- * @param: right = index of the right end
+ * @brief Prints the usage, to stderr as an error or to stdout for -h
  */
-void merge_sort_recursive(int32_t arr[], int left, int right)
+static void usage(const char *prog, FILE *out)
 {
+    fprintf(out,
+            "%s: %s [options] <n>\n"
+            "       %s -i <input> [-o <output>] [options]\n"
+            "       %s --external -i <input> -o <output> [options]\n"
+            "Without -i, n random keys are sorted.\n"
+            "  -i, --input <file>          file to sort, - for stdin\n"
+            "  -o, --output <file>         file to write the sorted keys to, - for stdout\n"
+            "  -f, --format <fmt>          format of the input: binary (native-endian int32, default) or\n"
+            "                              text (decimal numbers separated by whitespace)\n"
+            "  -F, --output-format <fmt>   format of the output, the input format by default\n"
+            "  -p, --print                 print the keys before and after sorting\n"
+            "  -c, --checksum              also check that the sorted keys are a permutation of the input\n"
+            "  -e, --external              sort the binary file <input> into <output>, which may be\n"
+            "                              larger than memory\n"
+            "  -m, --memory <size>         memory to use for --external, with an optional K, M or G\n"
+            "                              suffix (default 1G, at least 10M)\n"
+            "  -t, --threads <n>           number of threads (default: OMP_NUM_THREADS)\n"
+            "  -a, --algorithm <alg>       auto (default: radix sort from 64K keys, merge sort below),\n"
+            "                              merge, radix or sample\n"
+            "  -k, --kway <k>              number of parts the merge sort merges at once, 2 to 64\n"
+            "                              (default 2)\n"
+            "  -l, --in-place              merge sort in place, with about sqrt(n) scratch keys per thread\n"
+            "  -s, --stats[=<fmt>]         print where the sort spent its time, as text (default) or\n"
+            "                              json, if compiled with -DMERGE_SORT_STATS\n"
+            "  -h, --help                  print this help\n",
+            out == stderr ? "Error: usage" : "Usage", prog, prog, prog);
+}
 
-    if (left < right)
-    {
-        int size = right - left;
-        int mid = left + size / 2;
-
-        if (size < 2000)
-        {
-            merge_sort_recursive(arr, left, mid);
-            merge_sort_recursive(arr, mid + 1, right);
+/**
+ * @brief Parses "binary" or "text".
+ * @return 0 on success, -1 if it is neither
+ */
+static int parse_format(const char *str, enum io_format *format)
+{
+    if (strcmp(str, "binary") == 0)
+        *format = IO_BINARY;
+    else if (strcmp(str, "text") == 0)
+        *format = IO_TEXT;
+    else
+        return -1;
+    return 0;
+}
 
-            merge_sequential(arr, left, mid, right);
-        } else
-        {
-            // Splitting in two tasks. Taskwait will then wait for both tasks to finish.
-#pragma omp task
-            merge_sort_recursive(arr, left, mid);
+/**
+ * @brief Parses "auto", "merge", "radix" or "sample".
+ * @return 0 on success, -1 if it is none of them
+ */
+static int parse_algorithm(const char *str, enum merge_sort_algorithm *algorithm)
+{
+    if (strcmp(str, "auto") == 0)
+        *algorithm = MERGE_SORT_AUTO;
+    else if (strcmp(str, "merge") == 0)
+        *algorithm = MERGE_SORT_MERGE;
+    else if (strcmp(str, "radix") == 0)
+        *algorithm = MERGE_SORT_RADIX;
+    else if (strcmp(str, "sample") == 0)
+        *algorithm = MERGE_SORT_SAMPLE;
+    else
+        return -1;
+    return 0;
+}
 
-#pragma omp task
-            merge_sort_recursive(arr, mid + 1, right);
+/**
+ * @brief Parses a number with an optional K, M or G suffix (powers of 1024).
+ * @return 0 on success, -1 if str is not such a number
+ */
+static int parse_size(const char *str, size_t *size)
+{
+    char *endptr;
+    errno = 0;
+    unsigned long long value = strtoull(str, &endptr, 0);
+    if (errno != 0 || endptr == str || *str == '-')
+        return -1;
 
-#pragma omp taskwait
-            merge_parallel(arr, left, mid, right);
-        }
+    unsigned int shift = 0;
+    switch (*endptr)
+    {
+        case 'k':
+        case 'K':
+            shift = 10;
+            break;
+        case 'm':
+        case 'M':
+            shift = 20;
+            break;
+        case 'g':
+        case 'G':
+            shift = 30;
+            break;
+        case '\0':
+            break;
+        default:
+            return -1;
     }
+    if (shift > 0 && endptr[1] != '\0')
+        return -1;
+    if (value > (SIZE_MAX >> shift))
+        return -1;
+    *size = (size_t) value << shift;
+    return 0;
 }
 
 /**
- * @brief Function for checking whether or not an array's elements are ordered.
- * (https://www.geeksforgeeks.org/program-check-array-sorted-not-iterative-recursive/)
- * @param: arr
- * @param: n = length of the array
+ * @brief Prints the statistics of the sorts so far (see parallel_merge_sort_stats.h), as text or
+ * as one JSON object.
  */
-int is_array_sorted(int arr[], int n)
+static void print_stats(FILE *file, int json)
 {
-    if (n == 1 || n == 0)
-        return 1;
+    struct merge_sort_stats stats;
+    merge_sort_stats_get(&stats);
 
-    // Unsorted pair found (Equal values allowed)
-    if (arr[n - 1] < arr[n - 2])
+    if (json)
     {
-        return 0;
+        fprintf(file,
+                "{\"sorts\": %llu, \"sort_seconds\": %.6f, \"tasks\": %llu, \"copy_seconds\": %.6f, "
+                "\"copy_elements\": %llu, \"leaf_seconds\": %.6f, \"leaf_calls\": %llu, \"leaf_elements\": %llu, "
+                "\"radix_histogram_seconds\": %.6f, \"radix_scatter_seconds\": %.6f, \"radix_passes\": %llu, "
+                "\"merges\": [",
+                (unsigned long long) stats.sorts, stats.sort_seconds, (unsigned long long) stats.tasks,
+                stats.copy_seconds, (unsigned long long) stats.copy_elements, stats.leaf_seconds,
+                (unsigned long long) stats.leaf_calls, (unsigned long long) stats.leaf_elements,
+                stats.radix_histogram_seconds, stats.radix_scatter_seconds, (unsigned long long) stats.radix_passes);
+        const char *separator = "";
+        for (int l = 0; l < MERGE_SORT_STATS_LEVELS; l++)
+        {
+            if (stats.merge_chunks[l] == 0)
+                continue;
+            fprintf(file, "%s{\"log2_size\": %d, \"seconds\": %.6f, \"elements\": %llu, \"chunks\": %llu}",
+                    separator, l, stats.merge_seconds[l], (unsigned long long) stats.merge_elements[l],
+                    (unsigned long long) stats.merge_chunks[l]);
+            separator = ", ";
+        }
+        fprintf(file, "]}\n");
+        return;
     }
 
-    // recursive call
-    return is_array_sorted(arr, n - 1);
+    fprintf(file, "sorts: %llu, %2.4f seconds, %llu tasks\n", (unsigned long long) stats.sorts, stats.sort_seconds,
+            (unsigned long long) stats.tasks);
+    fprintf(file, "copy: %2.4f thread-seconds, %llu elements\n", stats.copy_seconds,
+            (unsigned long long) stats.copy_elements);
+    fprintf(file, "leaves: %2.4f thread-seconds, %llu leaves, %llu elements\n", stats.leaf_seconds,
+            (unsigned long long) stats.leaf_calls, (unsigned long long) stats.leaf_elements);
+    if (stats.radix_passes > 0)
+        fprintf(file, "radix: %2.4f thread-seconds counting, %2.4f moving, %llu passes\n",
+                stats.radix_histogram_seconds, stats.radix_scatter_seconds, (unsigned long long) stats.radix_passes);
+    for (int l = MERGE_SORT_STATS_LEVELS - 1; l >= 0; l--)
+    {
+        if (stats.merge_chunks[l] > 0)
+            fprintf(file, "merges of 2^%d: %2.4f thread-seconds, %llu elements in %llu chunks\n", l,
+                    stats.merge_seconds[l], (unsigned long long) stats.merge_elements[l],
+                    (unsigned long long) stats.merge_chunks[l]);
+    }
 }
 
+/**
+ * @brief Prints arr[0..n-1] after the label, buffered by stdio.
+ */
+static void print_array(const char *label, const int32_t *arr, size_t n)
+{
+    printf("%s: \n", label);
+    for (size_t i = 0; i < n; i++)
+    {
+        printf("%d ", arr[i]);
+    }
+    printf("\n");
+}
 
 int main(int argc, char **argv)
 {
 
     /****************** handle input ******************/
-    if (argc != 2)
+    static const struct option long_options[] = {
+        {"input", required_argument, NULL, 'i'},
+        {"output", required_argument, NULL, 'o'},
+        {"format", required_argument, NULL, 'f'},
+        {"output-format", required_argument, NULL, 'F'},
+        {"print", no_argument, NULL, 'p'},
+        {"checksum", no_argument, NULL, 'c'},
+        {"external", no_argument, NULL, 'e'},
+        {"memory", required_argument, NULL, 'm'},
+        {"threads", required_argument, NULL, 't'},
+        {"algorithm", required_argument, NULL, 'a'},
+        {"kway", required_argument, NULL, 'k'},
+        {"in-place", no_argument, NULL, 'l'},
+        {"stats", optional_argument, NULL, 's'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    int external = 0;
+    int print = 0;
+    int checksum = 0;
+    const char *input = NULL;
+    const char *output = NULL;
+    enum io_format in_format = IO_BINARY;
+    enum io_format out_format = IO_BINARY;
+    int out_format_set = 0;
+    size_t memory = 0;
+    int nthreads = 0;
+    struct merge_sort_options opts = {0};
+    int stats = -1;     // -1: no statistics, 0: as text, 1: as JSON
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "i:o:f:F:pcem:t:a:k:ls::h", long_options, NULL)) != -1)
     {
-        fprintf(stderr, "Error: usage: %s <n>\n", argv[0]);
-        return EXIT_FAILURE;
+        switch (opt)
+        {
+            case 'i':
+                input = optarg;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'f':
+            case 'F':
+                if (parse_format(optarg, opt == 'f' ? &in_format : &out_format) != 0)
+                {
+                    fprintf(stderr, "Error: unknown format '%s'!\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                out_format_set |= opt == 'F';
+                break;
+            case 'p':
+                print = 1;
+                break;
+            case 'c':
+                checksum = 1;
+                break;
+            case 'e':
+                external = 1;
+                break;
+            case 'm':
+                if (parse_size(optarg, &memory) != 0)
+                {
+                    fprintf(stderr, "Error: invalid memory size '%s'!\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 't':
+                nthreads = atoi(optarg);
+                if (nthreads <= 0)
+                {
+                    fprintf(stderr, "Error: invalid number of threads '%s'!\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'a':
+                if (parse_algorithm(optarg, &opts.algorithm) != 0)
+                {
+                    fprintf(stderr, "Error: unknown algorithm '%s'!\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'k':
+                opts.kway = atoi(optarg);
+                if (opts.kway < 2 || opts.kway > 64)
+                {
+                    fprintf(stderr, "Error: invalid k '%s'!\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'l':
+                opts.memory = MERGE_SORT_IN_PLACE;
+                break;
+            case 's':
+                if (optarg == NULL || strcmp(optarg, "text") == 0)
+                    stats = 0;
+                else if (strcmp(optarg, "json") == 0)
+                    stats = 1;
+                else
+                {
+                    fprintf(stderr, "Error: unknown statistics format '%s'!\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'h':
+                usage(argv[0], stdout);
+                return EXIT_SUCCESS;
+            default:
+                usage(argv[0], stderr);
+                return EXIT_FAILURE;
+        }
     }
-    errno = 0;
-    char *str = argv[1];
-    char *endptr;
-    long n = strtol(str, &endptr, 0);
-    if (errno != 0)
+    if (!out_format_set)
+        out_format = in_format;
+    opts.nthreads = nthreads;
+
+    // Timing goes to stderr when the keys are written to stdout
+    FILE *report = output != NULL && strcmp(output, "-") == 0 ? stderr : stdout;
+
+    struct merge_sort_stats probe;
+    if (stats >= 0 && merge_sort_stats_get(&probe) != 0)
     {
-        perror("strtol");
+        fprintf(stderr, "Error: --stats needs a build with -DMERGE_SORT_STATS!\n");
         return EXIT_FAILURE;
     }
-    if (endptr == str)
+
+    if (external)
     {
-        fprintf(stderr, "Error: no digits were found!\n");
-        return EXIT_FAILURE;
+        if (input == NULL || output == NULL || optind != argc || in_format != IO_BINARY ||
+            out_format != IO_BINARY || strcmp(input, "-") == 0 || strcmp(output, "-") == 0)
+        {
+            usage(argv[0], stderr);
+            return EXIT_FAILURE;
+        }
+
+        double start_time = omp_get_wtime();
+        if (parallel_merge_sort_external(input, output, memory, &opts) != 0)
+        {
+            fprintf(stderr, "Error: sorting %s into %s failed: %s\n", input, output, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        fprintf(report, "time: %2.2f seconds\n", omp_get_wtime() - start_time);
+        if (stats >= 0)
+            print_stats(report, stats);
+        return EXIT_SUCCESS;
     }
-    if (n < 0)
+
+    if ((input != NULL) == (optind + 1 == argc) || optind + 1 < argc)
     {
-        fprintf(stderr, "Error: matrix size must not be negative!\n");
+        usage(argv[0], stderr);
         return EXIT_FAILURE;
     }
-    /******************************************************************************/
-
-    /******** allocation of the array and filling it with random numbers **********/
 
     int32_t *arr;
-    arr = (int32_t *) calloc(n, sizeof(int32_t));
+    size_t n;
+    double start_time = omp_get_wtime();
+    double read_time = 0.0;
 
-    if (arr == NULL)
+    if (input != NULL)
     {
-        printf("MALLOC ERROR\n");
-        return EXIT_FAILURE;
-    }
+        /************************** reading the keys **************************/
+        size_t bad = 0;
+        int ret = in_format == IO_TEXT ? io_read_text(input, nthreads, &arr, &n, &bad)
+                                       : io_read_binary(input, nthreads, &arr, &n);
+        if (ret != 0)
+        {
+            if (errno == EINVAL && in_format == IO_TEXT)
+                fprintf(stderr, "Error: %s: not a number at byte %zu!\n", input, bad);
+            else if (errno == EINVAL)
+                fprintf(stderr, "Error: %s: size is not a multiple of 4 bytes!\n", input);
+            else
+                fprintf(stderr, "Error: reading %s failed: %s\n", input, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        read_time = omp_get_wtime() - start_time;
+        /**********************************************************************/
+    } else
+    {
+        errno = 0;
+        char *str = argv[optind];
+        char *endptr;
+        long long parsed_n = strtoll(str, &endptr, 0);
+        if (errno != 0)
+        {
+            perror("strtoll");
+            return EXIT_FAILURE;
+        }
+        if (endptr == str)
+        {
+            fprintf(stderr, "Error: no digits were found!\n");
+            return EXIT_FAILURE;
+        }
+        if (parsed_n < 0)
+        {
+            fprintf(stderr, "Error: matrix size must not be negative!\n");
+            return EXIT_FAILURE;
+        }
+        if ((unsigned long long) parsed_n > SIZE_MAX / sizeof(int32_t))
+        {
+            fprintf(stderr, "Error: matrix size too large!\n");
+            return EXIT_FAILURE;
+        }
+        n = (size_t) parsed_n;
 
-    // fill array with pseudo random numbers
-    srand(0);
+        /******** allocation of the array and filling it with random numbers **********/
 
-    double start_time;
-    double end_time;
+        // Placed the way the sort splits it between the threads
+        arr = (int32_t *) merge_sort_alloc_local(n, sizeof(int32_t), nthreads);
 
-#pragma omp parallel // parallelize the filling of the array, with an own seed for each thread
-    {
-        unsigned int my_seed = omp_get_thread_num();
-#pragma omp for
-        for (int i = 0; i < n; i++)
+        if (arr == NULL)
         {
-            arr[i] = rand_r(&my_seed) / 10000000;
+            printf("MALLOC ERROR\n");
+            return EXIT_FAILURE;
         }
-        /******************************************************************************/
 
+        // parallelize the filling of the array, with an own seed for each thread
+#pragma omp parallel num_threads(nthreads > 0 ? nthreads : omp_get_max_threads())
+        {
+            unsigned int my_seed = omp_get_thread_num();
+#pragma omp for schedule(static)
+            for (size_t i = 0; i < n; i++)
+            {
+                arr[i] = rand_r(&my_seed) / 10000000;
+            }
+        }
+        /******************************************************************************/
     }
-    // print array
-    printf("Before: \n");
-    for (int i = 0; i < n; i++)
+
+    if (print)
+        print_array("Before", arr, n);
+
+    uint64_t input_checksum = checksum ? array_checksum(arr, n, nthreads) : 0;
+
+    // Only the sort of the keys is counted, not the placement or the reading
+    merge_sort_stats_reset();
+    double sort_start = omp_get_wtime();
+
+    if (parallel_merge_sort_opts(arr, n, &opts) != 0)
     {
-        printf("%d ", arr[i]);
+        printf("MALLOC ERROR\n");
+        return EXIT_FAILURE;
     }
-    printf("\n");
 
-    start_time = omp_get_wtime();
+    double sort_time = omp_get_wtime() - sort_start;
 
-    merge_sort_recursive(arr, 0, n - 1);
+    if (print)
+        print_array("After", arr, n);
 
-    end_time = omp_get_wtime();
+    /************************** verifying the result **************************/
+    double verify_start = omp_get_wtime();
+    if (!is_array_sorted(arr, n, nthreads))
+    {
+        fprintf(stderr, "Error: the keys are not sorted!\n");
+        return EXIT_FAILURE;
+    }
+    if (checksum && array_checksum(arr, n, nthreads) != input_checksum)
+    {
+        fprintf(stderr, "Error: the sorted keys are not a permutation of the input!\n");
+        return EXIT_FAILURE;
+    }
+    double verify_time = omp_get_wtime() - verify_start;
+    /**************************************************************************/
 
-    printf("After: \n");
-    for (int i = 0; i < n; i++)
+    /************************** writing the keys **************************/
+    double write_start = omp_get_wtime();
+    if (output != NULL)
     {
-        printf("%d ", arr[i]);
+        int ret = out_format == IO_TEXT ? io_write_text(output, arr, n, nthreads) : io_write_binary(output, arr, n);
+        if (ret != 0)
+        {
+            fprintf(stderr, "Error: writing %s failed: %s\n", output, strerror(errno));
+            return EXIT_FAILURE;
+        }
     }
-    printf("\n");
+    double write_time = omp_get_wtime() - write_start;
+    /**********************************************************************/
 
-    assert(is_array_sorted(arr, n));
+    free(arr);
 
-    printf("time: %2.2f seconds\n", end_time - start_time);
+    if (input != NULL || output != NULL)
+    {
+        fprintf(report, "read: %2.2f, sort: %2.2f, verify: %2.2f, write: %2.2f seconds\n", read_time, sort_time,
+                verify_time, write_time);
+        // The verification is not part of the total
+        fprintf(report, "time: %2.2f seconds\n", read_time + sort_time + write_time);
+    } else
+        fprintf(report, "time: %2.2f seconds\n", sort_time);
+    if (stats >= 0)
+        print_stats(report, stats);
     return EXIT_SUCCESS;
 }
+#endif // PARALLEL_MERGE_SORT_NO_MAIN
 
@@ -0,0 +1,237 @@
+#ifndef PARALLEL_MERGE_SORT_H
+#define PARALLEL_MERGE_SORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * How much scratch memory the merges may use. Both modes are stable: elements with equal keys keep
+ * their relative order.
+ */
+enum merge_sort_memory
+{
+    MERGE_SORT_BUFFERED = 0,    // one scratch array of n elements, fastest
+    MERGE_SORT_IN_PLACE,        // about sqrt(n) scratch elements per thread, rotation-based merges
+};
+
+/**
+ * Loop used to merge two runs. Both give the same result.
+ */
+enum merge_sort_kernel
+{
+    MERGE_SORT_BRANCHLESS = 0,  // the comparison only selects the element (conditional moves)
+    MERGE_SORT_BRANCHY,         // if/else per element, kept for comparison
+};
+
+/**
+ * Sorting algorithm. The radix sort is available for the typed and key/value variants (not for
+ * parallel_merge_sort_generic()), the samplesort for all of them. Both need MERGE_SORT_BUFFERED,
+ * otherwise the merge sort is used. All of them are stable.
+ */
+enum merge_sort_algorithm
+{
+    MERGE_SORT_AUTO = 0,        // radix sort for arrays of at least 64K keys, merge sort otherwise
+    MERGE_SORT_MERGE,           // always the merge sort
+    MERGE_SORT_RADIX,           // parallel LSD radix sort, 8 bits per pass, if the type allows it
+    MERGE_SORT_SAMPLE,          // samplesort: one bucket per thread, split by sampled splitters and
+                                // sorted independently. Fewer passes over memory than the merge tree
+                                // for very large arrays.
+};
+
+/**
+ * Where the merge sort (MERGE_SORT_BUFFERED) does its work.
+ */
+enum merge_sort_placement
+{
+    MERGE_SORT_PLACE_AUTO = 0,  // MERGE_SORT_PLACE_LOCAL if the machine has more than one NUMA node
+    MERGE_SORT_PLACE_TASKS,     // any thread may sort or merge any part of the array (tasks)
+    MERGE_SORT_PLACE_LOCAL,     // every thread sorts one block and writes only that block of the
+                                // scratch array and of every merge, so the pages stay on its node.
+                                // Pin the threads for this to help, e.g. OMP_PLACES=cores.
+};
+
+/**
+ * Whether the sort makes use of runs that are already sorted in the input. Looking for them takes one
+ * pass over the array, and the list of runs takes one size_t per run.
+ */
+enum merge_sort_adaptive
+{
+    MERGE_SORT_ADAPTIVE_AUTO = 0,   // with MERGE_SORT_AUTO or MERGE_SORT_MERGE, look for sorted (or
+                                    // strictly decreasing) runs first, and only merge them if they are
+                                    // 64 elements long or more on average (a list of at most n / 64
+                                    // entries). A sorted array takes one pass over the data. A forced
+                                    // radix sort or samplesort does not look for runs.
+    MERGE_SORT_ADAPTIVE_OFF,        // always sort from scratch
+    MERGE_SORT_ADAPTIVE_ALWAYS,     // always look for runs and merge them, with any algorithm, if they
+                                    // are 8 elements long or more on average (a list of at most n / 8
+                                    // entries). With MERGE_SORT_IN_PLACE, the list gets no more entries
+                                    // than the per-thread buffers have elements, about sqrt(n) per
+                                    // thread. Otherwise the array is sorted from scratch.
+};
+
+// Value of merge_sort_options.cutoff that calibrates the cutoff (see merge_sort_calibrate_cutoff())
+#define MERGE_SORT_CUTOFF_AUTO SIZE_MAX
+
+/**
+ * Options for the *_opts() variants. A zero-initialised struct (or passing NULL) gives the defaults.
+ */
+struct merge_sort_options
+{
+    int nthreads;                   // number of threads to use, or <= 0 for the OpenMP default
+    enum merge_sort_memory memory;  // MERGE_SORT_BUFFERED by default
+    enum merge_sort_kernel kernel;  // MERGE_SORT_BRANCHLESS by default
+    size_t cutoff;                  // sub-arrays shorter than this are sorted without tasks. 0 takes
+                                    // MERGE_SORT_CUTOFF from the environment (a number or "auto")
+                                    // and falls back to 2000. MERGE_SORT_CUTOFF_AUTO calibrates it.
+    enum merge_sort_algorithm algorithm;    // MERGE_SORT_AUTO by default
+    enum merge_sort_placement placement;    // MERGE_SORT_PLACE_AUTO by default
+    enum merge_sort_adaptive adaptive;      // MERGE_SORT_ADAPTIVE_AUTO by default
+    int kway;                       // number of sorted parts merged at once by the merge sort: 2 for
+                                    // binary merges (also what 0 gives), up to 64 for a loser tree
+                                    // merge
+};
+
+/**
+ * @brief Sorts an array in ascending order using the parallel merge sort.
+ * Sets up an OpenMP team of nthreads threads, in which one thread creates the task tree and the
+ * others execute the tasks. Must not be called from inside an active parallel region. One scratch
+ * array of n elements is allocated per call. The sort is stable.
+ * @param: arr = array to sort
+ * @param: n = length of the array
+ * @param: nthreads = number of threads to use, or <= 0 for the OpenMP default (OMP_NUM_THREADS)
+ * @return 0 on success, -1 if the scratch array (n elements) could not be allocated. In that case
+ * arr is left unchanged.
+ */
+int parallel_merge_sort(int32_t *arr, size_t n, int nthreads);
+
+/**
+ * @brief Same as parallel_merge_sort(), with the options given in opts (may be NULL).
+ * With MERGE_SORT_IN_PLACE, only the per-thread buffers are allocated, so peak memory stays close
+ * to the array itself.
+ */
+int parallel_merge_sort_opts(int32_t *arr, size_t n, const struct merge_sort_options *opts);
+
+/**
+ * @brief Same as parallel_merge_sort(), for other key types. Every type has its own instantiation
+ * of the sort, so the comparison is inlined into the merge loops. Floating point arrays must not
+ * contain NaNs.
+ */
+int parallel_merge_sort_int64(int64_t *arr, size_t n, int nthreads);
+int parallel_merge_sort_uint64(uint64_t *arr, size_t n, int nthreads);
+int parallel_merge_sort_float(float *arr, size_t n, int nthreads);
+int parallel_merge_sort_double(double *arr, size_t n, int nthreads);
+int parallel_merge_sort_int64_opts(int64_t *arr, size_t n, const struct merge_sort_options *opts);
+int parallel_merge_sort_uint64_opts(uint64_t *arr, size_t n, const struct merge_sort_options *opts);
+int parallel_merge_sort_float_opts(float *arr, size_t n, const struct merge_sort_options *opts);
+int parallel_merge_sort_double_opts(double *arr, size_t n, const struct merge_sort_options *opts);
+
+/**
+ * @brief Sorts keys[0..n-1] and moves values[i] along with keys[i] (a struct of arrays, e.g. keys
+ * and record indices). The sort is stable: values with equal keys keep their relative order.
+ * @param: keys = array to sort by
+ * @param: values = payload array of the same length
+ * @return 0 on success, -1 if the scratch arrays could not be allocated
+ */
+int parallel_merge_sort_int32_kv(int32_t *keys, uint64_t *values, size_t n, int nthreads);
+int parallel_merge_sort_int64_kv(int64_t *keys, uint64_t *values, size_t n, int nthreads);
+int parallel_merge_sort_uint64_kv(uint64_t *keys, uint64_t *values, size_t n, int nthreads);
+int parallel_merge_sort_float_kv(float *keys, uint64_t *values, size_t n, int nthreads);
+int parallel_merge_sort_double_kv(double *keys, uint64_t *values, size_t n, int nthreads);
+int parallel_merge_sort_int32_kv_opts(int32_t *keys, uint64_t *values, size_t n,
+                                      const struct merge_sort_options *opts);
+int parallel_merge_sort_int64_kv_opts(int64_t *keys, uint64_t *values, size_t n,
+                                      const struct merge_sort_options *opts);
+int parallel_merge_sort_uint64_kv_opts(uint64_t *keys, uint64_t *values, size_t n,
+                                       const struct merge_sort_options *opts);
+int parallel_merge_sort_float_kv_opts(float *keys, uint64_t *values, size_t n,
+                                      const struct merge_sort_options *opts);
+int parallel_merge_sort_double_kv_opts(double *keys, uint64_t *values, size_t n,
+                                       const struct merge_sort_options *opts);
+
+/**
+ * @brief Sorts n elements of the given size with a qsort() style comparator. Equal elements keep
+ * their relative order. Calls compar for every comparison, so it is slower than the typed variants.
+ * @param: base = array to sort
+ * @param: n = number of elements
+ * @param: size = size of one element in bytes
+ * @param: compar = returns < 0, 0 or > 0 if the first element is less than, equal to or greater
+ * than the second one
+ * @return 0 on success, -1 if the scratch array could not be allocated
+ */
+int parallel_merge_sort_generic(void *base, size_t n, size_t size, int (*compar)(const void *, const void *),
+                                int nthreads);
+int parallel_merge_sort_generic_opts(void *base, size_t n, size_t size, int (*compar)(const void *, const void *),
+                                     const struct merge_sort_options *opts);
+
+/**
+ * @brief Sorts a binary file of native-endian int32 keys that may be larger than memory. Sorted runs
+ * are made with the in-memory sort, written to a temporary file next to output, and merged k at a
+ * time. Reads and writes are done in the background with POSIX AIO, so sorting and merging overlap
+ * with the disk. input and output may be the same file.
+ * @param: input = file to sort
+ * @param: output = file the sorted keys are written to, created or truncated
+ * @param: memory = bytes of memory to use, 0 for 1 GiB, at least 10 MiB are used
+ * @param: opts = options of the in-memory sorts (may be NULL)
+ * @return 0 on success, -1 on error (errno is set, EINVAL if the input size is not a multiple of 4)
+ */
+int parallel_merge_sort_external(const char *input, const char *output, size_t memory,
+                                 const struct merge_sort_options *opts);
+
+/**
+ * @brief Allocates an array of n elements of the given size for sorting with nthreads threads.
+ * Every thread zeroes the block it owns in MERGE_SORT_PLACE_LOCAL, so on a NUMA machine (with
+ * pinned threads) each block is on the node of the thread that sorts it. Free it with free().
+ * @param: nthreads = number of threads, or <= 0 for the OpenMP default
+ * @return the array, or NULL if it could not be allocated
+ */
+void *merge_sort_alloc_local(size_t n, size_t size, int nthreads);
+
+/**
+ * @brief Finds the fastest sequential cutoff for this machine and thread count. Sorts a sample of
+ * 2M random int32 keys with a few candidate cutoffs and picks the fastest. The result is cached in
+ * $MERGE_SORT_CUTOFF_CACHE, $XDG_CACHE_HOME/parallel_merge_sort_cutoff or
+ * ~/.cache/parallel_merge_sort_cutoff, per host name and thread count, so this only measures once
+ * per host. Used for MERGE_SORT_CUTOFF_AUTO and MERGE_SORT_CUTOFF=auto.
+ * @param: nthreads = number of threads the sorts will use, or <= 0 for the OpenMP default
+ * @return the cutoff
+ */
+size_t merge_sort_calibrate_cutoff(int nthreads);
+
+// Merges are counted by the floor of log2 of their size, up to this many levels
+#define MERGE_SORT_STATS_LEVELS 48
+
+/**
+ * Where the sorts spent their time, summed over all threads (thread-seconds). Only counted if
+ * parallel_merge_sort.c is compiled with -DMERGE_SORT_STATS, see parallel_merge_sort_stats.h.
+ */
+struct merge_sort_stats
+{
+    uint64_t sorts;                 // sort calls
+    double sort_seconds;            // wall time of the sort calls
+    uint64_t tasks;                 // tasks created by the merge sort
+    double copy_seconds;            // copying the input into the scratch array
+    uint64_t copy_elements;
+    double leaf_seconds;            // sequential leaves: sub-arrays sorted without tasks
+    uint64_t leaf_calls;
+    uint64_t leaf_elements;
+    double merge_seconds[MERGE_SORT_STATS_LEVELS];      // parallel merges of 2^l to 2^(l+1)-1
+    uint64_t merge_elements[MERGE_SORT_STATS_LEVELS];   // elements, by level l
+    uint64_t merge_chunks[MERGE_SORT_STATS_LEVELS];
+    double radix_histogram_seconds; // radix sort: counting the digits of a pass
+    double radix_scatter_seconds;   // radix sort: moving the keys of a pass
+    uint64_t radix_passes;          // passes that moved the keys (counted once per sort)
+};
+
+/**
+ * @brief Adds up the statistics of all threads since the start or the last merge_sort_stats_reset().
+ * Must not be called while a sort is running.
+ * @return 0 on success, -1 if the sort was compiled without MERGE_SORT_STATS (stats is zeroed)
+ */
+int merge_sort_stats_get(struct merge_sort_stats *stats);
+
+/**
+ * @brief Sets all statistics back to zero. Must not be called while a sort is running.
+ */
+void merge_sort_stats_reset(void);
+
+#endif // PARALLEL_MERGE_SORT_H
@@ -0,0 +1,514 @@
+/****************************************************************************************************
+ External sort of a binary file of int32 keys (parallel_merge_sort_external()):
+
+ The file may be larger than memory. It is sorted in two phases:
+
+ 1. Runs: the file is read in chunks of a quarter of the memory budget, every chunk is sorted with
+    the in-memory parallel sort and written to a temporary file. Three chunk buffers rotate, so the
+    next chunk is read and the previous one written (asynchronously, with POSIX AIO) while the
+    current one is sorted.
+ 2. Merge: the runs are merged k at a time. Every run has two block buffers, one that is consumed
+    and one that is read ahead in the background, so the merge does not wait for the disk as long
+    as the disk keeps up. The merge works in batches: every key that is not greater than the
+    smallest last key of the buffered blocks (of the runs that have more data on disk) can be output
+    right away. These keys are collected in a staging buffer, where they form up to k sorted runs,
+    and merged by the in-memory sort, which finds these runs and only merges them, in parallel. The
+    staging buffer is written out asynchronously while the next batch is built.
+    If there are more runs than fit into memory at once, they are merged in several passes.
+
+ All reads and writes are large and sequential within a run (at least EXTERNAL_MIN_BLOCK bytes).
+ ****************************************************************************************************/
+
+#ifndef PARALLEL_MERGE_SORT_EXTERNAL_H
+#define PARALLEL_MERGE_SORT_EXTERNAL_H
+
+#include <aio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "parallel_merge_sort.h"
+
+// Memory budget if none is given
+#define EXTERNAL_DEFAULT_MEMORY ((size_t) 1 << 30)
+
+// Smallest block read from a run during the merge, limits how many runs are merged at once
+#define EXTERNAL_MIN_BLOCK ((size_t) 1 << 20)
+
+// The merge needs 5 blocks per run: 2 read buffers, 2 staging buffers and the scratch of the sort
+#define EXTERNAL_BLOCKS_PER_RUN 5
+
+// Smallest memory budget, enough to merge two runs with blocks of EXTERNAL_MIN_BLOCK bytes
+#define EXTERNAL_MIN_MEMORY (EXTERNAL_BLOCKS_PER_RUN * 2 * EXTERNAL_MIN_BLOCK)
+
+// A sorted run in the temporary file, offset in bytes, length in keys
+struct ext_run
+{
+    off_t offset;
+    size_t length;
+};
+
+// One asynchronous read or write
+struct ext_io
+{
+    struct aiocb cb;
+    int pending;
+};
+
+/**
+ * @brief Reads or writes all of buf at offset, retrying after short transfers.
+ * @return 0 on success, -1 on error
+ */
+static int ext_transfer(int fd, void *buf, size_t bytes, off_t offset, int write)
+{
+    char *p = (char *) buf;
+    while (bytes > 0)
+    {
+        ssize_t done = write ? pwrite(fd, p, bytes, offset) : pread(fd, p, bytes, offset);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+        {
+            if (done == 0)
+                errno = EIO;    // the file ended early
+            return -1;
+        }
+        p += done;
+        bytes -= (size_t) done;
+        offset += done;
+    }
+    return 0;
+}
+
+/**
+ * @brief Starts reading (write = 0) or writing bytes of buf at offset in the background. Falls back
+ * to a synchronous transfer if the request can't be queued.
+ * @return 0 on success, -1 on error
+ */
+static int ext_io_start(struct ext_io *io, int fd, void *buf, size_t bytes, off_t offset, int write)
+{
+    memset(&io->cb, 0, sizeof(io->cb));
+    io->cb.aio_fildes = fd;
+    io->cb.aio_buf = buf;
+    io->cb.aio_nbytes = bytes;
+    io->cb.aio_offset = offset;
+    io->pending = 0;
+
+    if (bytes == 0)
+        return 0;
+    if ((write ? aio_write(&io->cb) : aio_read(&io->cb)) == 0)
+    {
+        io->pending = write ? 2 : 1;
+        return 0;
+    }
+    return ext_transfer(fd, buf, bytes, offset, write);
+}
+
+/**
+ * @brief Waits for the transfer started by ext_io_start(), and completes it if it was short.
+ * @return 0 on success, -1 on error
+ */
+static int ext_io_wait(struct ext_io *io)
+{
+    if (!io->pending)
+        return 0;
+
+    int write = io->pending == 2;
+    io->pending = 0;
+
+    const struct aiocb *list[1] = {&io->cb};
+    int err;
+    while ((err = aio_error(&io->cb)) == EINPROGRESS)
+        aio_suspend(list, 1, NULL);
+
+    ssize_t done = aio_return(&io->cb);
+    if (err != 0 || done < 0)
+    {
+        errno = err != 0 ? err : EIO;
+        return -1;
+    }
+    if ((size_t) done < io->cb.aio_nbytes)
+    {
+        return ext_transfer(io->cb.aio_fildes, (char *) io->cb.aio_buf + done, io->cb.aio_nbytes - (size_t) done,
+                            io->cb.aio_offset + done, write);
+    }
+    return 0;
+}
+
+/**
+ * @brief Creates a temporary file next to path, which is removed again when it is closed.
+ * @return the file descriptor, or -1 on error
+ */
+static int ext_temp_file(const char *path)
+{
+    size_t len = strlen(path);
+    char *name = (char *) malloc(len + sizeof(".runs.XXXXXX"));
+    if (name == NULL)
+        return -1;
+    memcpy(name, path, len);
+    memcpy(name + len, ".runs.XXXXXX", sizeof(".runs.XXXXXX"));
+
+    int fd = mkstemp(name);
+    if (fd >= 0)
+        unlink(name);
+    free(name);
+    return fd;
+}
+
+/**
+ * @brief Phase 1: sorts the n keys of in_fd in chunks of run_len keys and writes them to out_fd.
+ * @param: runs = set to the runs, (n + run_len - 1) / run_len entries
+ * @return 0 on success, -1 on error
+ */
+static int ext_make_runs(int in_fd, size_t n, int out_fd, size_t run_len, struct ext_run *runs,
+                         const struct merge_sort_options *opts)
+{
+    size_t nchunks = (n + run_len - 1) / run_len;
+    int32_t *bufs[3];
+    struct ext_io reads[3], writes[3];
+    int ret = 0;
+
+    memset(reads, 0, sizeof(reads));
+    memset(writes, 0, sizeof(writes));
+    for (int b = 0; b < 3; b++)
+        bufs[b] = (int32_t *) malloc(run_len * sizeof(int32_t));
+    if (bufs[0] == NULL || bufs[1] == NULL || bufs[2] == NULL)
+        ret = -1;
+
+    for (size_t c = 0; c < nchunks; c++)
+    {
+        runs[c].offset = (off_t) (c * run_len * sizeof(int32_t));
+        runs[c].length = c + 1 < nchunks ? run_len : n - c * run_len;
+    }
+
+    if (ret == 0 && ext_io_start(&reads[0], in_fd, bufs[0], runs[0].length * sizeof(int32_t), runs[0].offset, 0) != 0)
+        ret = -1;
+
+    for (size_t c = 0; c < nchunks && ret == 0; c++)
+    {
+        int b = (int) (c % 3);
+        if (ext_io_wait(&reads[b]) != 0)
+        {
+            ret = -1;
+            break;
+        }
+
+        // The next chunk goes into the buffer written two chunks ago
+        if (c + 1 < nchunks)
+        {
+            int next = (int) ((c + 1) % 3);
+            if (ext_io_wait(&writes[next]) != 0 ||
+                ext_io_start(&reads[next], in_fd, bufs[next], runs[c + 1].length * sizeof(int32_t),
+                             runs[c + 1].offset, 0) != 0)
+            {
+                ret = -1;
+                break;
+            }
+        }
+
+        if (parallel_merge_sort_opts(bufs[b], runs[c].length, opts) != 0 ||
+            ext_io_start(&writes[b], out_fd, bufs[b], runs[c].length * sizeof(int32_t), runs[c].offset, 1) != 0)
+            ret = -1;
+    }
+
+    for (int b = 0; b < 3; b++)
+    {
+        if (ext_io_wait(&reads[b]) != 0 || ext_io_wait(&writes[b]) != 0)
+            ret = -1;
+    }
+    for (int b = 0; b < 3; b++)
+        free(bufs[b]);
+    return ret;
+}
+
+// A run being merged: the block in buf[cur] is consumed, buf[1 - cur] is read ahead
+struct ext_source
+{
+    int32_t *buf[2];
+    int cur;
+    size_t pos, len;        // consumed and total keys of buf[cur]
+    size_t ahead_len;       // keys being read into buf[1 - cur]
+    off_t next, end;        // bytes of the run not requested yet
+    struct ext_io io;
+};
+
+/**
+ * @brief Requests the next block of the run into buf[1 - cur], if there is one.
+ */
+static int ext_source_read_ahead(struct ext_source *src, int fd, size_t block)
+{
+    size_t bytes = (size_t) (src->end - src->next) < block * sizeof(int32_t) ? (size_t) (src->end - src->next)
+                                                                             : block * sizeof(int32_t);
+    src->ahead_len = bytes / sizeof(int32_t);
+    if (bytes == 0)
+        return 0;
+
+    off_t offset = src->next;
+    src->next += (off_t) bytes;
+    return ext_io_start(&src->io, fd, src->buf[1 - src->cur], bytes, offset, 0);
+}
+
+/**
+ * @brief Makes the block that was read ahead the current one, and reads the next one ahead.
+ */
+static int ext_source_advance(struct ext_source *src, int fd, size_t block)
+{
+    if (ext_io_wait(&src->io) != 0)
+        return -1;
+    src->cur = 1 - src->cur;
+    src->pos = 0;
+    src->len = src->ahead_len;
+    return ext_source_read_ahead(src, fd, block);
+}
+
+/**
+ * @brief Index of the first of the keys a[0..n-1] that is greater than bound
+ */
+static size_t ext_upper_bound(const int32_t *a, size_t n, int32_t bound)
+{
+    size_t lo = 0;
+    while (n > 0)
+    {
+        size_t half = n / 2;
+        if (a[lo + half] <= bound)
+        {
+            lo += half + 1;
+            n -= half + 1;
+        } else
+            n = half;
+    }
+    return lo;
+}
+
+/**
+ * @brief Phase 2: merges the k runs of in_fd into out_fd, starting at out_offset.
+ * @param: block = keys per read of a run
+ * @return 0 on success, -1 on error
+ */
+static int ext_merge_runs(int in_fd, const struct ext_run *runs, int k, int out_fd, off_t out_offset, size_t block,
+                          const struct merge_sort_options *opts)
+{
+    struct ext_source *sources = (struct ext_source *) calloc((size_t) k, sizeof(struct ext_source));
+    int32_t *staging[2] = {NULL, NULL};
+    struct ext_io writes[2];
+    int ret = 0;
+
+    memset(writes, 0, sizeof(writes));
+    if (sources == NULL)
+        return -1;
+
+    staging[0] = (int32_t *) malloc((size_t) k * block * sizeof(int32_t));
+    staging[1] = (int32_t *) malloc((size_t) k * block * sizeof(int32_t));
+    if (staging[0] == NULL || staging[1] == NULL)
+        ret = -1;
+
+    for (int r = 0; r < k && ret == 0; r++)
+    {
+        struct ext_source *src = &sources[r];
+        src->buf[0] = (int32_t *) malloc(block * sizeof(int32_t));
+        src->buf[1] = (int32_t *) malloc(block * sizeof(int32_t));
+        src->cur = 1;
+        src->next = runs[r].offset;
+        src->end = runs[r].offset + (off_t) (runs[r].length * sizeof(int32_t));
+        if (src->buf[0] == NULL || src->buf[1] == NULL || ext_source_read_ahead(src, in_fd, block) != 0 ||
+            ext_source_advance(src, in_fd, block) != 0)
+            ret = -1;
+    }
+
+    // The batches only hold a few long runs, so the in-memory sort just merges them
+    struct merge_sort_options batch_opts = opts != NULL ? *opts : (struct merge_sort_options) {0};
+    batch_opts.adaptive = MERGE_SORT_ADAPTIVE_AUTO;
+
+    int s = 0;
+    while (ret == 0)
+    {
+        // The keys up to bound are the smallest ones that have not been output yet
+        int have_bound = 0;
+        int32_t bound = 0;
+        int active = 0;
+        for (int r = 0; r < k; r++)
+        {
+            struct ext_source *src = &sources[r];
+            if (src->pos == src->len && src->ahead_len > 0 && ext_source_advance(src, in_fd, block) != 0)
+            {
+                ret = -1;
+                break;
+            }
+            if (src->pos == src->len)
+                continue;
+            active++;
+            if (src->ahead_len > 0 && (!have_bound || src->buf[src->cur][src->len - 1] < bound))
+            {
+                bound = src->buf[src->cur][src->len - 1];
+                have_bound = 1;
+            }
+        }
+        if (ret != 0 || active == 0)
+            break;
+
+        // staging[s] is free again once its last write is done
+        if (ext_io_wait(&writes[s]) != 0)
+        {
+            ret = -1;
+            break;
+        }
+
+        size_t total = 0;
+        for (int r = 0; r < k; r++)
+        {
+            struct ext_source *src = &sources[r];
+            const int32_t *keys = src->buf[src->cur] + src->pos;
+            size_t count = have_bound ? ext_upper_bound(keys, src->len - src->pos, bound) : src->len - src->pos;
+
+            memcpy(staging[s] + total, keys, count * sizeof(int32_t));
+            src->pos += count;
+            total += count;
+        }
+
+        if (parallel_merge_sort_opts(staging[s], total, &batch_opts) != 0 ||
+            ext_io_start(&writes[s], out_fd, staging[s], total * sizeof(int32_t), out_offset, 1) != 0)
+        {
+            ret = -1;
+            break;
+        }
+        out_offset += (off_t) (total * sizeof(int32_t));
+        s = 1 - s;
+    }
+
+    for (int b = 0; b < 2; b++)
+    {
+        if (ext_io_wait(&writes[b]) != 0)
+            ret = -1;
+        free(staging[b]);
+    }
+    for (int r = 0; r < k; r++)
+    {
+        if (ext_io_wait(&sources[r].io) != 0)
+            ret = -1;
+        free(sources[r].buf[0]);
+        free(sources[r].buf[1]);
+    }
+    free(sources);
+    return ret;
+}
+
+/**
+ * @brief Sorts the file input into output, see parallel_merge_sort_external() in
+ * parallel_merge_sort.h.
+ */
+static int ext_sort_file(const char *input, const char *output, size_t memory, const struct merge_sort_options *opts)
+{
+    if (memory == 0)
+        memory = EXTERNAL_DEFAULT_MEMORY;
+    if (memory < EXTERNAL_MIN_MEMORY)
+        memory = EXTERNAL_MIN_MEMORY;
+
+    int in_fd = open(input, O_RDONLY);
+    if (in_fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(in_fd, &st) != 0)
+    {
+        close(in_fd);
+        return -1;
+    }
+    if (st.st_size % (off_t) sizeof(int32_t) != 0)
+    {
+        // Not a whole number of keys
+        close(in_fd);
+        errno = EINVAL;
+        return -1;
+    }
+    size_t n = (size_t) st.st_size / sizeof(int32_t);
+    posix_fadvise(in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // Phase 1 holds three chunks and the scratch array of the sort
+    size_t run_len = memory / (4 * sizeof(int32_t));
+    if (run_len > n)
+        run_len = n;
+    if (run_len < 1)
+        run_len = 1;
+    size_t nruns = n > 0 ? (n + run_len - 1) / run_len : 0;
+
+    // The merge reads blocks of at least EXTERNAL_MIN_BLOCK bytes
+    size_t fan_in = memory / (EXTERNAL_BLOCKS_PER_RUN * EXTERNAL_MIN_BLOCK);
+    if (fan_in < 2)
+        fan_in = 2;
+
+    struct ext_run *runs = (struct ext_run *) malloc((nruns > 0 ? nruns : 1) * sizeof(struct ext_run));
+    int run_fd = nruns > 1 ? ext_temp_file(output) : -1;
+    int out_fd = -1;
+    int ret = 0;
+
+    if (runs == NULL || (nruns > 1 && run_fd < 0))
+        ret = -1;
+
+    if (ret == 0 && nruns <= 1)
+    {
+        // Fits into memory, sorted in one go. output may be input, so it is only truncated (to the size of
+        // the sorted keys) once the chunk has been read.
+        out_fd = open(output, O_WRONLY | O_CREAT, 0644);
+        if (out_fd < 0 || (nruns == 1 && ext_make_runs(in_fd, n, out_fd, run_len, runs, opts) != 0) ||
+            ftruncate(out_fd, (off_t) (n * sizeof(int32_t))) != 0)
+            ret = -1;
+    } else if (ret == 0)
+        ret = ext_make_runs(in_fd, n, run_fd, run_len, runs, opts);
+
+    // Merge passes until the remaining runs can be merged into the output at once. The runs hold all
+    // keys of input by now, so truncating output is safe even if it is input.
+    while (ret == 0 && nruns > 1)
+    {
+        int final = nruns <= fan_in;
+        int k = (int) (final ? nruns : fan_in);
+        size_t block = memory / ((size_t) k * EXTERNAL_BLOCKS_PER_RUN * sizeof(int32_t));
+        if (block < 1)
+            block = 1;
+
+        int dst_fd = final ? open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644) : ext_temp_file(output);
+        if (dst_fd < 0)
+        {
+            ret = -1;
+            break;
+        }
+
+        size_t merged = 0;
+        for (size_t first = 0; first < nruns && ret == 0; first += (size_t) k)
+        {
+            int group = nruns - first < (size_t) k ? (int) (nruns - first) : k;
+            struct ext_run run = {runs[first].offset, 0};
+            for (int r = 0; r < group; r++)
+                run.length += runs[first + (size_t) r].length;
+
+            ret = ext_merge_runs(run_fd, runs + first, group, dst_fd, run.offset, block, opts);
+            runs[merged++] = run;
+        }
+
+        close(run_fd);
+        run_fd = -1;
+        if (final)
+            out_fd = dst_fd;
+        else
+            run_fd = dst_fd;
+        nruns = merged;
+    }
+
+    int saved = errno;
+    if (out_fd >= 0 && close(out_fd) != 0 && ret == 0)
+    {
+        saved = errno;
+        ret = -1;
+    }
+    if (run_fd >= 0)
+        close(run_fd);
+    close(in_fd);
+    free(runs);
+    errno = saved;
+    return ret;
+}
+
+#endif // PARALLEL_MERGE_SORT_EXTERNAL_H
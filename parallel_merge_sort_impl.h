@@ -0,0 +1,1794 @@
+/****************************************************************************************************
+Parallel merge sort:
+
+ The array is split into sub-arrays until each sub-array only holds one element. This way, all
+ sub-arrays are sorted (since they only have 1 element). Then, all sub-array are merged with their
+ "neighbouring" sub-array, and so on, until all are merged to one array.
+
+ Therefore, when starting the merge operation we have a very large number of very small arrays.
+ Merging them requires very little CPU time. That's why it makes sense to merge them sequentially
+ up to a certain array length (2000 by default - found by trying out different numbers), in order to
+ avoid the overheads of parallelism. Once the arrays have reached this certain size, the operation
+ takes much more time and it becomes reasonable to parallelize it. The best length depends on the
+ machine, so it can be set per call, through MERGE_SORT_CUTOFF, or measured (see
+ merge_sort_calibrate_cutoff() in parallel_merge_sort.h).
+
+ ****************************************************************************************************/
+
+/****************************************************************************************************
+ This file is a template, it is included by parallel_merge_sort.c once for every element type. Before
+ including it, define:
+
+ SORT_NAME      suffix of the generated functions, e.g. int32 -> merge_sort_recursive_int32()
+ SORT_KEY_T     the key type, compared with SORT_LESS(x, y) (defaults to x < y)
+
+ and optionally one of:
+
+ SORT_PAYLOAD_T  sort a struct of arrays: every key has a value of this type that is moved with it
+ SORT_GENERIC    sort elements of a run-time size with a qsort() style comparator (SORT_KEY_T unused)
+
+ A key type with an order-preserving mapping to an unsigned integer can also be radix sorted:
+
+ SORT_RADIX_T       unsigned integer type of the same width as SORT_KEY_T
+ SORT_RADIX_KEY(x)  maps key x to a SORT_RADIX_T, so that x < y exactly if the mapped x < mapped y
+
+ A plain key type can also provide a kernel for small sub-arrays:
+
+ SORT_LEAF(a, first, count)  sorts a[first..first+count-1] in place and evaluates to 1, or evaluates
+                             to 0 if no kernel is available
+ SORT_LEAF_MAX               largest count SORT_LEAF() accepts
+
+ The element type is hidden behind SORT_ARRAY (a pointer, or a struct of pointers), which is always
+ accessed through an index. SORT_LEQ(), SORT_MOVE(), SORT_SWAP() and SORT_AT() are the only operations
+ the algorithm needs, so every type gets a merge loop with the comparison inlined.
+ All macros are undefined again at the end of the file.
+ ****************************************************************************************************/
+
+#ifndef PARALLEL_MERGE_SORT_IMPL_ONCE
+#define PARALLEL_MERGE_SORT_IMPL_ONCE
+
+// Default length below which sub-arrays are sorted and merged sequentially (see above)
+#define SEQUENTIAL_CUTOFF 2000
+
+#define SORT_CAT_(a, b) a##_##b
+#define SORT_CAT(a, b) SORT_CAT_(a, b)
+#define SORT_FN(name) SORT_CAT(name, SORT_NAME)
+
+static const struct merge_sort_options merge_sort_default_options = {0};
+
+// Settings of one sort call, resolved from its struct merge_sort_options
+struct sort_config
+{
+    int branchless;     // merge with the branchless kernel
+    size_t cutoff;      // sub-arrays shorter than this are sorted and merged sequentially
+    int kway;           // number of runs merged at once above the cutoff, 2 for binary merges
+    int task_depth;     // recursion depth from which on no more tasks are created
+};
+
+// Turns merge_sort_options.cutoff into the cutoff to use (defined in parallel_merge_sort.c)
+static size_t merge_sort_resolve_cutoff(size_t requested, int nthreads);
+
+// Largest number of runs a k-way merge takes
+#define MAX_KWAY 64
+
+// A k-way merge is only used if the chunk of every thread is at least this many times k^2 log2(n)
+#define KWAY_CHUNK_FACTOR 16
+
+// Turns merge_sort_options.kway into the k to use (defined in parallel_merge_sort.c)
+static int merge_sort_resolve_kway(int requested);
+
+// Number of NUMA nodes of the machine (defined in parallel_merge_sort.c)
+static int merge_sort_numa_nodes(void);
+
+// Number of levels a task tree goes below log2 of the number of threads. About 2^3 = 8 tasks per
+// thread are enough to even out the load, more only add creation and taskwait overhead
+#define TASK_DEPTH_SLACK 3
+
+// Smallest l with 2^l >= x
+static inline int ceil_log2(size_t x)
+{
+    int l = 0;
+    while (((size_t) 1 << l) < x)
+        l++;
+    return l;
+}
+
+// Start of block t of n elements split into p blocks, the same split as schedule(static) in libgomp
+static inline size_t block_start(size_t n, size_t p, size_t t)
+{
+    return t * (n / p) + (t < n % p ? t : n % p);
+}
+
+// The radix sort sorts by RADIX_BITS bits per pass, starting with the least significant ones
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+
+// Bytes buffered per bucket before they are written to the destination (one cache line)
+#define RADIX_LINE 64
+
+// With MERGE_SORT_AUTO, arrays of at least this many keys are radix sorted if the type allows it
+#define RADIX_MIN_N (1 << 16)
+
+// The samplesort draws this many sample elements per bucket to choose the splitters
+#define SAMPLE_OVERSAMPLE 64
+
+// With MERGE_SORT_ADAPTIVE_AUTO, the existing runs are only merged if they are at least this long
+// on average, otherwise the array is sorted from scratch
+#define ADAPTIVE_MIN_RUN 64
+
+// With MERGE_SORT_ADAPTIVE_ALWAYS, the list of runs has room for n / ADAPTIVE_ALWAYS_MIN_RUN runs (in
+// place: as many as the per-thread buffers have elements). Shorter runs are sorted from scratch.
+#define ADAPTIVE_ALWAYS_MIN_RUN 8
+
+#endif // PARALLEL_MERGE_SORT_IMPL_ONCE
+
+#ifndef SORT_LESS
+#define SORT_LESS(x, y) ((x) < (y))
+#endif
+
+#define SORT_ARRAY SORT_FN(sort_array)
+
+#if defined(SORT_GENERIC)
+
+typedef struct
+{
+    char *base;
+    size_t size;
+    int (*compar)(const void *, const void *);
+} SORT_ARRAY;
+
+// a[i] may be placed before b[j]: it is not greater (ties keep their order)
+#define SORT_LEQ(a, i, b, j) ((a).compar((a).base + (i) * (a).size, (b).base + (j) * (b).size) <= 0)
+#define SORT_MOVE(d, di, s, si) memcpy((d).base + (di) * (d).size, (s).base + (si) * (s).size, (d).size)
+#define SORT_SWAP(a, i, j)                                                              \
+    do {                                                                                \
+        char *x_ = (a).base + (i) * (a).size, *y_ = (a).base + (j) * (a).size;          \
+        for (size_t b_ = 0; b_ < (a).size; b_++)                                        \
+        {                                                                               \
+            char t_ = x_[b_];                                                           \
+            x_[b_] = y_[b_];                                                            \
+            y_[b_] = t_;                                                                \
+        }                                                                               \
+    } while (0)
+// the same array, starting at element off
+#define SORT_AT(a, off) ((SORT_ARRAY) {(a).base + (off) * (a).size, (a).size, (a).compar})
+
+#elif defined(SORT_PAYLOAD_T)
+
+typedef struct
+{
+    SORT_KEY_T *keys;
+    SORT_PAYLOAD_T *values;
+} SORT_ARRAY;
+
+#define SORT_LEQ(a, i, b, j) (!SORT_LESS((b).keys[j], (a).keys[i]))
+#define SORT_MOVE(d, di, s, si) ((d).keys[di] = (s).keys[si], (d).values[di] = (s).values[si])
+#define SORT_SWAP(a, i, j)                                                              \
+    do {                                                                                \
+        SORT_KEY_T k_ = (a).keys[i];                                                    \
+        SORT_PAYLOAD_T v_ = (a).values[i];                                              \
+        (a).keys[i] = (a).keys[j];                                                      \
+        (a).values[i] = (a).values[j];                                                  \
+        (a).keys[j] = k_;                                                               \
+        (a).values[j] = v_;                                                             \
+    } while (0)
+#define SORT_AT(a, off) ((SORT_ARRAY) {(a).keys + (off), (a).values + (off)})
+
+#else
+
+typedef SORT_KEY_T *SORT_ARRAY;
+
+#define SORT_LEQ(a, i, b, j) (!SORT_LESS((b)[j], (a)[i]))
+#define SORT_MOVE(d, di, s, si) ((d)[di] = (s)[si])
+#define SORT_SWAP(a, i, j)                                                              \
+    do {                                                                                \
+        SORT_KEY_T t_ = (a)[i];                                                         \
+        (a)[i] = (a)[j];                                                                \
+        (a)[j] = t_;                                                                    \
+    } while (0)
+#define SORT_AT(a, off) ((a) + (off))
+
+#endif
+
+/**
+ * @brief Computes the co-rank of k for the merge of two sorted arrays: the number of elements of L
+ * that are among the first k elements of the (stable) merge of L and R. The remaining k - i elements
+ * come from R. This is the point where the merge path crosses the k-th anti-diagonal.
+ * @param: k = index in the merged output (0 <= k <= n1 + n2)
+ * @param: src = array holding L and R
+ * @param: l0 = index of the first element of L, n1 = its length
+ * @param: r0 = index of the first element of R, n2 = its length
+ */
+static size_t SORT_FN(co_rank)(size_t k, SORT_ARRAY src, size_t l0, size_t n1, size_t r0, size_t n2)
+{
+    size_t lo = k > n2 ? k - n2 : 0;
+    size_t hi = k < n1 ? k : n1;
+
+    while (lo < hi)
+    {
+        size_t i = lo + (hi - lo) / 2;
+
+        // L[i] is among the first k elements if at most k - i - 1 elements of R are smaller than it.
+        // Equal elements are taken from L first, which keeps the merge stable.
+        if (SORT_LEQ(src, l0 + i, src, r0 + k - i - 1))
+            lo = i + 1;
+        else
+            hi = i;
+    }
+    return lo;
+}
+
+/**
+ * @brief Merges a[i..i_last-1] and b[j..j_last-1] into dst, starting at dst[k]. Takes from a on
+ * ties. This is the classic merge loop with one branch per element, which is mispredicted about half
+ * of the time on random keys. dst may be the array a or b, as long as no element is overwritten
+ * before it is read.
+ */
+static void SORT_FN(merge_runs_branchy)(SORT_ARRAY a, size_t i, size_t i_last, SORT_ARRAY b, size_t j,
+                                        size_t j_last, SORT_ARRAY dst, size_t k)
+{
+    while (i < i_last && j < j_last)
+    {
+        if (SORT_LEQ(a, i, b, j))
+        {
+            SORT_MOVE(dst, k, a, i);
+            i++;
+        } else
+        {
+            SORT_MOVE(dst, k, b, j);
+            j++;
+        }
+        k++;
+    }
+
+    // Copy the remaining elements of the first subarray, if there are any
+    while (i < i_last)
+    {
+        SORT_MOVE(dst, k, a, i);
+        i++;
+        k++;
+    }
+
+    // Copy the remaining elements of the second subarray, if there are any
+    while (j < j_last)
+    {
+        SORT_MOVE(dst, k, b, j);
+        j++;
+        k++;
+    }
+}
+
+/**
+ * @brief Same as merge_runs_branchy(), but the comparison result only selects which element is
+ * copied and which index is advanced. The compiler turns that into conditional moves, so there is
+ * nothing to mispredict.
+ */
+static void SORT_FN(merge_runs_branchless)(SORT_ARRAY a, size_t i, size_t i_last, SORT_ARRAY b, size_t j,
+                                           size_t j_last, SORT_ARRAY dst, size_t k)
+{
+    while (i < i_last && j < j_last)
+    {
+        int take_b = !SORT_LEQ(a, i, b, j);
+        SORT_MOVE(dst, k, take_b ? b : a, take_b ? j : i);
+        i += !take_b;
+        j += take_b;
+        k++;
+    }
+
+    while (i < i_last)
+    {
+        SORT_MOVE(dst, k, a, i);
+        i++;
+        k++;
+    }
+
+    while (j < j_last)
+    {
+        SORT_MOVE(dst, k, b, j);
+        j++;
+        k++;
+    }
+}
+
+static inline void SORT_FN(merge_runs)(SORT_ARRAY a, size_t i, size_t i_last, SORT_ARRAY b, size_t j,
+                                       size_t j_last, SORT_ARRAY dst, size_t k, const struct sort_config *cfg)
+{
+    if (cfg->branchless)
+        SORT_FN(merge_runs_branchless)(a, i, i_last, b, j, j_last, dst, k);
+    else
+        SORT_FN(merge_runs_branchy)(a, i, i_last, b, j, j_last, dst, k);
+}
+
+/**
+ * @brief Parallel function to merge to sub-arrays (src[left..mid] and src[mid+1..right]) into
+ * dst[left..right]. The output is split into one equally sized chunk per thread. The start of each
+ * chunk in both sub-arrays is found with co_rank(), so every chunk is merged independently of the
+ * others. The chunks are tasks of the team the sort already runs in, no nested parallel region is
+ * opened. Returns when all chunks are merged.
+ * @param: src = array holding the two sorted sub-arrays
+ * @param: dst = array the merged result is written to
+ * @param: left = index of the left end
+ * @param: mid = index of the middle of the array
+ * @param: right = index of the right end
+ * @param: cfg = settings of the sort
+ */
+static void SORT_FN(merge_parallel)(SORT_ARRAY src, SORT_ARRAY dst, size_t left, size_t mid, size_t right,
+                                    const struct sort_config *cfg)
+{
+    size_t n1 = mid - left + 1;
+    size_t n2 = right - mid;
+    size_t n = n1 + n2;
+
+    // One chunk per thread, but no chunk smaller than what is merged sequentially anyway
+    size_t p = (size_t) omp_get_num_threads();
+    if (p > n / cfg->cutoff)
+        p = n / cfg->cutoff > 0 ? n / cfg->cutoff : 1;
+
+    // The implicit taskgroup of the taskloop waits for all chunks
+#pragma omp taskloop grainsize(1)
+    for (size_t t = 0; t < p; t++)
+    {
+        // Merge the sub-arrays into dst[left..right], chunk t writes dst[left+k_begin..left+k_end-1]
+        size_t k_begin = n / p * t + n % p * t / p;
+        size_t k_end = n / p * (t + 1) + n % p * (t + 1) / p;
+
+        size_t i_begin = SORT_FN(co_rank)(k_begin, src, left, n1, mid + 1, n2);
+        size_t i_end = SORT_FN(co_rank)(k_end, src, left, n1, mid + 1, n2);
+
+        size_t i = left + i_begin;                          // Initial index of first subarray
+        size_t j = mid + 1 + (k_begin - i_begin);           // Initial index of second subarray
+        size_t k = left + k_begin;                          // Initial index of merged subarray
+        size_t i_last = left + i_end;
+        size_t j_last = mid + 1 + (k_end - i_end);
+
+        STATS_START(merge_start);
+        SORT_FN(merge_runs)(src, i, i_last, src, j, j_last, dst, k, cfg);
+        STATS_MERGE(merge_start, n, k_end - k_begin);
+    }
+}
+
+/**
+ * @brief Non-parallel function to merge to sub-arrays (src[left..mid] and src[mid+1..right]) into
+ * dst[left..right]
+ * @param: src = array holding the two sorted sub-arrays
+ * @param: dst = array the merged result is written to
+ * @param: left = index of the left end
+ * @param: mid = index of the middle of the array
+ * @param: right = index of the right end
+ * @param: cfg = settings of the sort
+ */
+static void SORT_FN(merge_sequential)(SORT_ARRAY src, SORT_ARRAY dst, size_t left, size_t mid, size_t right,
+                                      const struct sort_config *cfg)
+{
+    SORT_FN(merge_runs)(src, left, mid + 1, src, mid + 1, right + 1, dst, left, cfg);
+}
+
+/**
+ * @brief Recursive merge sort algorithm. Sorts the elements of src[left..right] into dst[left..right].
+ * Both arrays have to hold the same elements in this range when it is called. The halves are sorted
+ * into src (with dst as scratch space) and then merged into dst, so the two arrays switch roles on
+ * every level of the recursion and no merge needs a temporary array or a copy-back pass.
+ * @param: src = scratch array, its content in the range is destroyed
+ * @param: dst = array that holds the sorted range afterwards
+ * Ranges of at least cfg->cutoff elements are split into tasks, down to cfg->task_depth levels
+ * below the first call. The halves of deeper ranges are sorted and merged sequentially: unlike
+ * final(), this also skips the task constructs and the co_rank() searches of merge_parallel(),
+ * which would only run in the same thread anyway.
+ * @param: left = index of the left end
+ * @param: right = index of the right end
+ * @param: depth = number of task levels above this call
+ * @param: cfg = settings of the sort
+ */
+static void SORT_FN(merge_sort_recursive)(SORT_ARRAY src, SORT_ARRAY dst, size_t left, size_t right, int depth,
+                                          const struct sort_config *cfg)
+{
+
+    if (left < right)
+    {
+        size_t size = right - left;
+        size_t mid = left + size / 2;
+
+#ifdef SORT_LEAF
+        // dst already holds the same elements as src, so the kernel can sort them right there
+        if (size < SORT_LEAF_MAX && SORT_LEAF(dst, left, size + 1))
+            return;
+#endif
+
+        if (size < cfg->cutoff || depth >= cfg->task_depth)
+        {
+            STATS_LEAF_START(leaf_start);
+            SORT_FN(merge_sort_recursive)(dst, src, left, mid, depth, cfg);
+            SORT_FN(merge_sort_recursive)(dst, src, mid + 1, right, depth, cfg);
+
+            SORT_FN(merge_sequential)(src, dst, left, mid, right, cfg);
+            STATS_LEAF_END(leaf_start, size + 1);
+        } else
+        {
+            // The left half becomes a task, this thread sorts the right half itself and then waits
+            // for the task. Nothing here depends on the thread it runs on, so the task is untied.
+            STATS_TASK();
+#pragma omp task untied
+            SORT_FN(merge_sort_recursive)(dst, src, left, mid, depth + 1, cfg);
+
+            SORT_FN(merge_sort_recursive)(dst, src, mid + 1, right, depth + 1, cfg);
+
+#pragma omp taskwait
+            SORT_FN(merge_parallel)(src, dst, left, mid, right, cfg);
+        }
+    }
+}
+
+/**
+ * @brief Merge sort with a fixed home for every element (MERGE_SORT_PLACE_LOCAL). Called by every
+ * thread of the team. Thread t owns block t of both arrays: it copies the block into tmp, which
+ * places the block's scratch pages on its node, and sorts it sequentially. Then the blocks are
+ * merged pairwise, level by level. Each pair is merged by the threads owning its blocks, and every
+ * thread writes exactly its own block of the output, starting where co_rank() finds it. All writes
+ * stay on the thread's node, only the reads of a merge cross into the other half of the pair.
+ * @param: arr = array to sort, holds the result afterwards
+ * @param: tmp = scratch array of n elements, not touched yet
+ * @param: cfg = settings of the sort
+ */
+static void SORT_FN(merge_sort_blocks)(SORT_ARRAY arr, SORT_ARRAY tmp, size_t n, const struct sort_config *cfg)
+{
+    size_t t = (size_t) omp_get_thread_num();
+    size_t p = (size_t) omp_get_num_threads();
+    size_t begin = block_start(n, p, t);
+    size_t end = block_start(n, p, t + 1);
+
+    int levels = 0;
+    while (((size_t) 1 << levels) < p)
+        levels++;
+
+    // The result of the last level has to end up in arr, and every level switches the arrays
+    SORT_ARRAY from = levels % 2 == 0 ? arr : tmp;
+    SORT_ARRAY to = levels % 2 == 0 ? tmp : arr;
+
+    struct sort_config sequential = *cfg;
+    sequential.cutoff = SIZE_MAX;
+
+    STATS_START(copy_start);
+    for (size_t i = begin; i < end; i++)
+        SORT_MOVE(tmp, i, arr, i);
+    STATS_COPY(copy_start, end - begin);
+    if (end - begin > 1)
+        SORT_FN(merge_sort_recursive)(to, from, begin, end - 1, 0, &sequential);
+
+    for (int level = 0; level < levels; level++)
+    {
+        // Wait until the runs of the previous level are complete
+#pragma omp barrier
+        size_t width = (size_t) 1 << level;
+        size_t first_block = t >> (level + 1) << (level + 1);
+        size_t mid_block = first_block + width < p ? first_block + width : p;
+        size_t last_block = first_block + 2 * width < p ? first_block + 2 * width : p;
+
+        size_t lo = block_start(n, p, first_block);
+        size_t mid = block_start(n, p, mid_block);
+        size_t hi = block_start(n, p, last_block);
+
+        STATS_START(level_start);
+        if (mid == hi)
+        {
+            // No right neighbour on this level, the run is only moved to the other array
+            for (size_t i = begin; i < end; i++)
+                SORT_MOVE(to, i, from, i);
+            STATS_COPY(level_start, end - begin);
+        } else
+        {
+            size_t i_begin = SORT_FN(co_rank)(begin - lo, from, lo, mid - lo, mid, hi - mid);
+            size_t i_end = SORT_FN(co_rank)(end - lo, from, lo, mid - lo, mid, hi - mid);
+
+            SORT_FN(merge_runs)(from, lo + i_begin, lo + i_end, from, mid + (begin - lo - i_begin),
+                                mid + (end - lo - i_end), to, begin, cfg);
+            STATS_MERGE(level_start, hi - lo, end - begin);
+        }
+
+        SORT_ARRAY swap = from;
+        from = to;
+        to = swap;
+    }
+}
+
+/****************************************************************************************************
+ In-place mode (MERGE_SORT_IN_PLACE):
+
+ Instead of a scratch array of n elements, every thread only gets a buffer of about max(sqrt(n), cutoff)
+ elements. Two sorted runs are merged through the buffer if the shorter one fits into it. Otherwise
+ the longer run is cut in the middle, the matching position in the other run is found by binary
+ search, and the two inner pieces are swapped with a rotation. This leaves two independent, smaller
+ merges, which for large merges are run as tasks. Every step keeps equal elements in their order,
+ so the sort stays stable. The rotations cost some throughput compared to the buffered mode.
+
+ The functions below use half-open ranges: the runs are arr[first..middle-1] and arr[middle..last-1].
+ ****************************************************************************************************/
+
+/**
+ * @brief Index of the first element in arr[first..last-1] that is not less than arr[x]
+ */
+static size_t SORT_FN(lower_bound)(SORT_ARRAY arr, size_t first, size_t last, size_t x)
+{
+    while (first < last)
+    {
+        size_t m = first + (last - first) / 2;
+        if (SORT_LEQ(arr, x, arr, m))
+            last = m;
+        else
+            first = m + 1;
+    }
+    return first;
+}
+
+/**
+ * @brief Index of the first element in arr[first..last-1] that is greater than arr[x]
+ */
+static size_t SORT_FN(upper_bound)(SORT_ARRAY arr, size_t first, size_t last, size_t x)
+{
+    while (first < last)
+    {
+        size_t m = first + (last - first) / 2;
+        if (SORT_LEQ(arr, m, arr, x))
+            first = m + 1;
+        else
+            last = m;
+    }
+    return first;
+}
+
+/**
+ * @brief Reverses arr[first..last-1]. Large ranges are split into tasks if parallel != 0.
+ */
+static void SORT_FN(reverse)(SORT_ARRAY arr, size_t first, size_t last, int parallel)
+{
+    size_t half = (last - first) / 2;
+
+    if (parallel && half >= 2 * SEQUENTIAL_CUTOFF)
+    {
+#pragma omp taskloop grainsize(SEQUENTIAL_CUTOFF)
+        for (size_t i = 0; i < half; i++)
+            SORT_SWAP(arr, first + i, last - 1 - i);
+    } else
+    {
+        for (size_t i = 0; i < half; i++)
+            SORT_SWAP(arr, first + i, last - 1 - i);
+    }
+}
+
+/**
+ * @brief Swaps the blocks arr[first..middle-1] and arr[middle..last-1] (three reversals).
+ * @return the new position of arr[middle]
+ */
+static size_t SORT_FN(rotate)(SORT_ARRAY arr, size_t first, size_t middle, size_t last, int parallel)
+{
+    if (first == middle || middle == last)
+        return first == middle ? last : first;
+
+    SORT_FN(reverse)(arr, first, middle, parallel);
+    SORT_FN(reverse)(arr, middle, last, parallel);
+    SORT_FN(reverse)(arr, first, last, parallel);
+    return first + (last - middle);
+}
+
+/**
+ * @brief Computes where the merge of arr[first..middle-1] and arr[middle..last-1] is split: the
+ * longer run is cut in the middle and the cut in the other run is found by binary search, such that
+ * all elements left of both cuts belong before all elements right of them.
+ */
+static void SORT_FN(split_runs)(SORT_ARRAY arr, size_t first, size_t middle, size_t last,
+                                size_t *first_cut, size_t *second_cut)
+{
+    if (middle - first > last - middle)
+    {
+        *first_cut = first + (middle - first) / 2;
+        *second_cut = SORT_FN(lower_bound)(arr, middle, last, *first_cut);
+    } else
+    {
+        *second_cut = middle + (last - middle) / 2;
+        *first_cut = SORT_FN(upper_bound)(arr, first, middle, *second_cut);
+    }
+}
+
+/**
+ * @brief Sequential stable merge of arr[first..middle-1] and arr[middle..last-1] in place, using
+ * buf[0..buf_size-1] as scratch space.
+ */
+static void SORT_FN(merge_adaptive)(SORT_ARRAY arr, size_t first, size_t middle, size_t last,
+                                    SORT_ARRAY buf, size_t buf_size, const struct sort_config *cfg)
+{
+    while (first < middle && middle < last && !SORT_LEQ(arr, middle - 1, arr, middle))
+    {
+        size_t n1 = middle - first;
+        size_t n2 = last - middle;
+
+        if (n1 <= n2 && n1 <= buf_size)
+        {
+            // Move the first run into the buffer and merge from the front
+            for (size_t i = 0; i < n1; i++)
+                SORT_MOVE(buf, i, arr, first + i);
+
+            // The output never overtakes the second run, so it can be merged into arr directly
+            SORT_FN(merge_runs)(buf, 0, n1, arr, middle, last, arr, first, cfg);
+            return;
+        }
+
+        if (n2 <= buf_size)
+        {
+            // Move the second run into the buffer and merge from the back
+            for (size_t j = 0; j < n2; j++)
+                SORT_MOVE(buf, j, arr, middle + j);
+
+            size_t i = middle, j = n2, k = last;
+            while (i > first && j > 0)
+            {
+                if (SORT_LEQ(arr, i - 1, buf, j - 1))
+                {
+                    SORT_MOVE(arr, k - 1, buf, j - 1);
+                    j--;
+                } else
+                {
+                    SORT_MOVE(arr, k - 1, arr, i - 1);
+                    i--;
+                }
+                k--;
+            }
+            // The rest of the first run is already in place
+            while (j > 0)
+            {
+                SORT_MOVE(arr, k - 1, buf, j - 1);
+                j--;
+                k--;
+            }
+            return;
+        }
+
+        // Neither run fits into the buffer: split both runs, rotate, merge the left part recursively
+        // and continue with the right part
+        size_t first_cut, second_cut;
+        SORT_FN(split_runs)(arr, first, middle, last, &first_cut, &second_cut);
+        size_t new_middle = SORT_FN(rotate)(arr, first_cut, middle, second_cut, 0);
+
+        SORT_FN(merge_adaptive)(arr, first, first_cut, new_middle, buf, buf_size, cfg);
+        first = new_middle;
+        middle = second_cut;
+    }
+}
+
+/**
+ * @brief Parallel stable merge of arr[first..middle-1] and arr[middle..last-1] in place. bufs holds
+ * one scratch buffer of buf_size elements per thread. Like merge_sort_recursive(), the merge is split
+ * into tasks down to cfg->task_depth levels, below that it is merged sequentially.
+ * @param: depth = number of task levels above this call
+ */
+static void SORT_FN(merge_in_place_parallel)(SORT_ARRAY arr, size_t first, size_t middle, size_t last,
+                                             SORT_ARRAY bufs, size_t buf_size, int depth,
+                                             const struct sort_config *cfg)
+{
+    size_t n1 = middle - first;
+    size_t n2 = last - middle;
+
+    if (last - first < cfg->cutoff || n1 <= buf_size || n2 <= buf_size || depth >= cfg->task_depth)
+    {
+        // Nothing in here is a task scheduling point, so the thread's buffer is not shared
+        size_t t = (size_t) omp_get_thread_num();
+        SORT_FN(merge_adaptive)(arr, first, middle, last, SORT_AT(bufs, t * buf_size), buf_size, cfg);
+        return;
+    }
+    if (SORT_LEQ(arr, middle - 1, arr, middle))
+        return;
+
+    size_t first_cut, second_cut;
+    SORT_FN(split_runs)(arr, first, middle, last, &first_cut, &second_cut);
+    size_t new_middle = SORT_FN(rotate)(arr, first_cut, middle, second_cut, 1);
+
+    // The left part becomes a task, this thread merges the right part itself. The buffers are looked
+    // up where they are used, so the task may be untied.
+    STATS_TASK();
+#pragma omp task untied
+    SORT_FN(merge_in_place_parallel)(arr, first, first_cut, new_middle, bufs, buf_size, depth + 1, cfg);
+
+    SORT_FN(merge_in_place_parallel)(arr, new_middle, second_cut, last, bufs, buf_size, depth + 1, cfg);
+
+#pragma omp taskwait
+}
+
+/**
+ * @brief Sequential in-place merge sort of arr[first..last-1]
+ */
+static void SORT_FN(merge_sort_in_place_sequential)(SORT_ARRAY arr, size_t first, size_t last,
+                                                    SORT_ARRAY buf, size_t buf_size,
+                                                    const struct sort_config *cfg)
+{
+    if (last - first < 2)
+        return;
+
+#ifdef SORT_LEAF
+    if (last - first <= SORT_LEAF_MAX && SORT_LEAF(arr, first, last - first))
+        return;
+#endif
+
+    size_t middle = first + (last - first) / 2;
+    SORT_FN(merge_sort_in_place_sequential)(arr, first, middle, buf, buf_size, cfg);
+    SORT_FN(merge_sort_in_place_sequential)(arr, middle, last, buf, buf_size, cfg);
+    SORT_FN(merge_adaptive)(arr, first, middle, last, buf, buf_size, cfg);
+}
+
+/**
+ * @brief Recursive in-place merge sort of arr[first..last-1]. bufs holds one scratch buffer of
+ * buf_size elements per thread. Ranges are split into tasks down to cfg->task_depth levels, like in
+ * merge_sort_recursive().
+ * @param: depth = number of task levels above this call
+ */
+static void SORT_FN(merge_sort_in_place)(SORT_ARRAY arr, size_t first, size_t last, SORT_ARRAY bufs,
+                                         size_t buf_size, int depth, const struct sort_config *cfg)
+{
+    size_t size = last - first;
+
+    if (size < cfg->cutoff || depth >= cfg->task_depth)
+    {
+        size_t t = (size_t) omp_get_thread_num();
+        SORT_FN(merge_sort_in_place_sequential)(arr, first, last, SORT_AT(bufs, t * buf_size), buf_size, cfg);
+        return;
+    }
+
+    size_t middle = first + size / 2;
+
+    // The left half becomes an untied task, this thread sorts the right half itself and then waits
+    STATS_TASK();
+#pragma omp task untied
+    SORT_FN(merge_sort_in_place)(arr, first, middle, bufs, buf_size, depth + 1, cfg);
+
+    SORT_FN(merge_sort_in_place)(arr, middle, last, bufs, buf_size, depth + 1, cfg);
+
+#pragma omp taskwait
+    SORT_FN(merge_in_place_parallel)(arr, first, middle, last, bufs, buf_size, depth, cfg);
+}
+
+/****************************************************************************************************
+ k-way merge (merge_sort_options.kway > 2):
+
+ Above the cutoff, a range is split into k parts instead of two, and the sorted parts are merged in
+ a single pass through a loser tree, so every element passes through memory log_k instead of log_2
+ times. The output of a merge is split into one chunk per thread. The start of a chunk in each of
+ the k runs is found exactly by multiway_split(), the k-way version of co_rank(). Ties are taken
+ from the run with the lower index, which keeps the merge stable.
+ ****************************************************************************************************/
+
+/**
+ * @brief Whether the element at offset x of run i comes before the element at offset y of run j in
+ * the stable merge of the runs bounds[i]..bounds[i+1]-1 of src. Offsets past the end of a run stand
+ * for padding elements that come after all real ones, in the order of run and offset.
+ */
+static inline int SORT_FN(multiway_before)(SORT_ARRAY src, const size_t *bounds, int i, size_t x, int j, size_t y)
+{
+    size_t p = bounds[i] + x, q = bounds[j] + y;
+    int pad_p = p >= bounds[i + 1], pad_q = q >= bounds[j + 1];
+
+    if (pad_p || pad_q)
+        return pad_p && pad_q ? i < j || (i == j && x < y) : pad_q;
+
+    // Ties go to the element at the lower position
+    return p < q ? SORT_LEQ(src, p, src, q) : !SORT_LEQ(src, q, src, p);
+}
+
+/**
+ * @brief Whether run a belongs above run b in the heap of multiway_split(): its element at offset
+ * at[a] comes first (max = 0) or last (max = 1).
+ */
+static inline int SORT_FN(multiway_above)(SORT_ARRAY src, const size_t *bounds, const size_t *at, int a, int b,
+                                          int max)
+{
+    return max ? SORT_FN(multiway_before)(src, bounds, b, at[b], a, at[a])
+               : SORT_FN(multiway_before)(src, bounds, a, at[a], b, at[b]);
+}
+
+/**
+ * @brief Adds run i to the binary heap of m runs, ordered by multiway_above().
+ */
+static void SORT_FN(multiway_push)(SORT_ARRAY src, const size_t *bounds, const size_t *at, int max, int *heap,
+                                   int m, int i)
+{
+    int node = m;
+    while (node > 0 && SORT_FN(multiway_above)(src, bounds, at, i, heap[(node - 1) / 2], max))
+    {
+        heap[node] = heap[(node - 1) / 2];
+        node = (node - 1) / 2;
+    }
+    heap[node] = i;
+}
+
+/**
+ * @brief Takes the top run out of the binary heap of m runs.
+ * @return the top run
+ */
+static int SORT_FN(multiway_pop)(SORT_ARRAY src, const size_t *bounds, const size_t *at, int max, int *heap, int m)
+{
+    int top = heap[0];
+    int last = heap[--m];
+    int node = 0;
+    for (;;)
+    {
+        int child = 2 * node + 1;
+        if (child >= m)
+            break;
+        if (child + 1 < m && SORT_FN(multiway_above)(src, bounds, at, heap[child + 1], heap[child], max))
+            child++;
+        if (!SORT_FN(multiway_above)(src, bounds, at, heap[child], last, max))
+            break;
+        heap[node] = heap[child];
+        node = child;
+    }
+    heap[node] = last;
+    return top;
+}
+
+/**
+ * @brief Finds where the first r elements of the stable merge of the k runs end in every run, with
+ * a multi-sequence selection in the style of Varman et al.: the runs are padded to the same power
+ * of two length, and for step sizes s from that length down to 1, the samples of step s (the last
+ * element of every block of s) are split into the r / s smallest and the others. The split of step
+ * 2s, plus the new samples below its largest chosen one, is off by at most k samples, which are
+ * moved across through a heap. That takes O(k log k) comparisons per step, so O(k log k log n) in
+ * all, and the split of step 1 is the exact one.
+ * @param: pos = set to the index in src of the first element of every run that is not among them
+ */
+static void SORT_FN(multiway_split)(SORT_ARRAY src, const size_t *bounds, int k, size_t r, size_t *pos)
+{
+    size_t len = 1;
+    for (int i = 0; i < k; i++)
+    {
+        while (len < bounds[i + 1] - bounds[i])
+            len *= 2;
+    }
+
+    // a[i] = number of elements of run i that are chosen, a multiple of s
+    size_t a[MAX_KWAY], at[MAX_KWAY];
+    int heap[MAX_KWAY];
+    for (int i = 0; i < k; i++)
+        a[i] = 0;
+
+    for (size_t s = len; s > 0; s /= 2)
+    {
+        // The largest chosen sample of step 2s
+        int top = -1;
+        for (int i = 0; i < k; i++)
+        {
+            if (a[i] > 0 && (top < 0 || SORT_FN(multiway_before)(src, bounds, top, a[top] - 1, i, a[i] - 1)))
+                top = i;
+        }
+
+        // The new samples below it are chosen too, which keeps the chosen ones the smallest
+        size_t chosen = 0;
+        if (top >= 0)
+        {
+            size_t top_at = a[top] - 1;
+            for (int i = 0; i < k; i++)
+            {
+                if (a[i] < len && SORT_FN(multiway_before)(src, bounds, i, a[i] + s - 1, top, top_at))
+                    a[i] += s;
+            }
+        }
+        for (int i = 0; i < k; i++)
+            chosen += a[i] / s;
+
+        // Then the smallest samples that are not chosen are added, or the largest chosen ones removed,
+        // until r / s are chosen
+        size_t target = r / s;
+        int m = 0;
+        if (chosen < target)
+        {
+            for (int i = 0; i < k; i++)
+            {
+                at[i] = a[i] + s - 1;
+                if (a[i] < len)
+                    SORT_FN(multiway_push)(src, bounds, at, 0, heap, m++, i);
+            }
+            for (; chosen < target; chosen++)
+            {
+                int i = SORT_FN(multiway_pop)(src, bounds, at, 0, heap, m--);
+                a[i] += s;
+                at[i] += s;
+                if (a[i] < len)
+                    SORT_FN(multiway_push)(src, bounds, at, 0, heap, m++, i);
+            }
+        } else if (chosen > target)
+        {
+            for (int i = 0; i < k; i++)
+            {
+                at[i] = a[i] - 1;
+                if (a[i] > 0)
+                    SORT_FN(multiway_push)(src, bounds, at, 1, heap, m++, i);
+            }
+            for (; chosen > target; chosen--)
+            {
+                int i = SORT_FN(multiway_pop)(src, bounds, at, 1, heap, m--);
+                a[i] -= s;
+                at[i] -= s;
+                if (a[i] > 0)
+                    SORT_FN(multiway_push)(src, bounds, at, 1, heap, m++, i);
+            }
+        }
+    }
+
+    // r is at most the total length, so no padding element is chosen
+    for (int i = 0; i < k; i++)
+        pos[i] = bounds[i] + a[i];
+}
+
+/**
+ * @brief Whether the head of run a comes before the head of run b in the merge. The runs lie in src
+ * in the order of their indices, so a tie goes to the head at the lower position. Only one
+ * comparison, and no branch to mispredict.
+ */
+static inline int SORT_FN(run_beats)(SORT_ARRAY src, const size_t *head, int a, int b)
+{
+    int a_first = head[a] < head[b];
+    size_t first = a_first ? head[a] : head[b];
+    size_t second = a_first ? head[b] : head[a];
+    return SORT_LEQ(src, first, src, second) == a_first;
+}
+
+/**
+ * @brief Builds a loser tree over the runs 0..k-1: node k + i is the leaf of run i, the inner
+ * nodes 1..k-1 keep the run that lost the match there. Works for any k, the leaves just end up on
+ * two different levels.
+ * @return the overall winner
+ */
+static int SORT_FN(build_loser_tree)(SORT_ARRAY src, const size_t *head, int k, int *tree)
+{
+    int winner[2 * MAX_KWAY];
+    for (int i = 0; i < k; i++)
+        winner[k + i] = i;
+    for (int node = k - 1; node >= 1; node--)
+    {
+        int a = winner[2 * node], b = winner[2 * node + 1];
+        int a_wins = SORT_FN(run_beats)(src, head, a, b);
+        winner[node] = a_wins ? a : b;
+        tree[node] = a_wins ? b : a;
+    }
+    return winner[1];
+}
+
+/**
+ * @brief Merges the k runs src[pos[i]..end[i]-1] into dst, starting at dst[k_out], with a loser
+ * tree. After the winner's head is output, only the matches on the path from its leaf to the root
+ * are replayed, which takes about log2(k) comparisons per element. When a run is used up, it is
+ * taken out and the tree is rebuilt for the others, so the matches need no check for empty runs.
+ */
+static void SORT_FN(merge_loser_tree)(SORT_ARRAY src, const size_t *pos, const size_t *end, int k, SORT_ARRAY dst,
+                                      size_t k_out)
+{
+    // The runs that are not used up, in their original order
+    size_t head[MAX_KWAY], last[MAX_KWAY];
+    int m = 0;
+    for (int i = 0; i < k; i++)
+    {
+        if (pos[i] < end[i])
+        {
+            head[m] = pos[i];
+            last[m] = end[i];
+            m++;
+        }
+    }
+
+    int tree[MAX_KWAY];
+    while (m > 1)
+    {
+        int top = SORT_FN(build_loser_tree)(src, head, m, tree);
+
+        for (;;)
+        {
+            SORT_MOVE(dst, k_out, src, head[top]);
+            k_out++;
+            if (++head[top] == last[top])
+                break;
+
+            // Selects instead of branches, the outcome of every match is random on random input
+            for (int node = (m + top) / 2; node >= 1; node /= 2)
+            {
+                int challenger = tree[node];
+                int swap = SORT_FN(run_beats)(src, head, challenger, top);
+                tree[node] = swap ? top : challenger;
+                top = swap ? challenger : top;
+            }
+        }
+
+        // Take out the used up run
+        for (int i = top; i + 1 < m; i++)
+        {
+            head[i] = head[i + 1];
+            last[i] = last[i + 1];
+        }
+        m--;
+    }
+
+    if (m == 1)
+    {
+        for (size_t i = head[0]; i < last[0]; i++, k_out++)
+            SORT_MOVE(dst, k_out, src, i);
+    }
+}
+
+/**
+ * @brief Parallel k-way merge of the runs src[bounds[i]..bounds[i+1]-1] (i < k) into
+ * dst[bounds[0]..bounds[k]-1]. One chunk of the output per thread, like merge_parallel().
+ */
+static void SORT_FN(merge_kway_parallel)(SORT_ARRAY src, SORT_ARRAY dst, const size_t *bounds, int k,
+                                         const struct sort_config *cfg)
+{
+    size_t n = bounds[k] - bounds[0];
+
+    size_t p = (size_t) omp_get_num_threads();
+    if (p > n / cfg->cutoff)
+        p = n / cfg->cutoff > 0 ? n / cfg->cutoff : 1;
+
+#pragma omp taskloop grainsize(1)
+    for (size_t t = 0; t < p; t++)
+    {
+        size_t k_begin = n / p * t + n % p * t / p;
+        size_t k_end = n / p * (t + 1) + n % p * (t + 1) / p;
+        size_t pos[MAX_KWAY], end[MAX_KWAY];
+
+        STATS_START(merge_start);
+        SORT_FN(multiway_split)(src, bounds, k, k_begin, pos);
+        SORT_FN(multiway_split)(src, bounds, k, k_end, end);
+        SORT_FN(merge_loser_tree)(src, pos, end, k, dst, bounds[0] + k_begin);
+        STATS_MERGE(merge_start, n, k_end - k_begin);
+    }
+}
+
+/**
+ * @brief Like merge_sort_recursive(), but ranges of at least cfg->kway * cfg->cutoff elements are
+ * split into cfg->kway parts, which are sorted as tasks and then merged at once. Such a split counts
+ * as log2(cfg->kway) levels of cfg->task_depth. Ranges whose chunks per thread are not much larger
+ * than k^2 log2(n) are left to binary merges, the two splits per chunk would cost about as much as
+ * the chunk's merge.
+ */
+static void SORT_FN(merge_sort_kway)(SORT_ARRAY src, SORT_ARRAY dst, size_t left, size_t right, int depth,
+                                     const struct sort_config *cfg)
+{
+    size_t size = right - left + 1;
+    int k = cfg->kway;
+    size_t chunk = size / (size_t) omp_get_num_threads();
+
+    if (size / (size_t) k < cfg->cutoff || depth >= cfg->task_depth ||
+        chunk / KWAY_CHUNK_FACTOR < (size_t) k * (size_t) k * (size_t) ceil_log2(size))
+    {
+        SORT_FN(merge_sort_recursive)(src, dst, left, right, depth, cfg);
+        return;
+    }
+
+    size_t bounds[MAX_KWAY + 1];
+    for (int i = 0; i <= k; i++)
+        bounds[i] = left + size / k * i + size % k * i / k;
+
+    // The last part is sorted by this thread while the others run as tasks
+    int child_depth = depth + ceil_log2((size_t) k);
+    for (int i = 0; i < k - 1; i++)
+    {
+        STATS_TASK();
+#pragma omp task untied firstprivate(i) shared(bounds)
+        SORT_FN(merge_sort_kway)(dst, src, bounds[i], bounds[i + 1] - 1, child_depth, cfg);
+    }
+    SORT_FN(merge_sort_kway)(dst, src, bounds[k - 1], bounds[k] - 1, child_depth, cfg);
+
+#pragma omp taskwait
+    SORT_FN(merge_kway_parallel)(src, dst, bounds, k, cfg);
+}
+
+/****************************************************************************************************
+ Natural merge (MERGE_SORT_ADAPTIVE_AUTO / MERGE_SORT_ADAPTIVE_ALWAYS):
+
+ Before sorting, every thread scans its block of the array for runs that are already sorted:
+ non-decreasing ones, and strictly decreasing ones, which are reversed on the spot (they contain no
+ equal elements, so this does not break stability). Runs that continue across a block boundary are
+ joined again. An array that is one run is sorted after this pass. Otherwise, only the runs are
+ merged: the list of runs is split where a run boundary is closest to the middle of the range, both
+ halves are merged recursively and then merged with each other, like merge_sort_recursive() and
+ merge_sort_in_place() do. A few long runs take few levels, so nearly sorted input costs about
+ n log(runs) instead of n log(n).
+ ****************************************************************************************************/
+
+/**
+ * @brief Scans arr[begin..end-1] for runs and reverses the decreasing ones. Writes the start of
+ * every run to starts.
+ * @param: capacity = size of starts, the scan stops when it is full
+ * @return the number of runs, or capacity + 1 if there are more than that
+ */
+static size_t SORT_FN(find_runs)(SORT_ARRAY arr, size_t begin, size_t end, size_t *starts, size_t capacity)
+{
+    size_t count = 0;
+    size_t i = begin;
+
+    while (i < end)
+    {
+        if (count == capacity)
+            return capacity + 1;
+        starts[count++] = i;
+
+        size_t j = i + 1;
+        if (j < end && !SORT_LEQ(arr, i, arr, j))
+        {
+            while (j + 1 < end && !SORT_LEQ(arr, j, arr, j + 1))
+                j++;
+            SORT_FN(reverse)(arr, i, j + 1, 0);
+            j++;
+        } else
+        {
+            while (j < end && SORT_LEQ(arr, j - 1, arr, j))
+                j++;
+        }
+        i = j;
+    }
+    return count;
+}
+
+/**
+ * @brief Finds the sorted runs of arr[0..n-1] in parallel, see above.
+ * @param: max_runs = room for this many runs, spread evenly over the blocks of the threads
+ * @param: nruns = set to the number of runs
+ * @return the starts of the runs followed by n (nruns + 1 entries, to be freed by the caller), or
+ * NULL if a block has more runs than it has room for or the list could not be allocated
+ */
+static size_t *SORT_FN(detect_runs)(SORT_ARRAY arr, size_t n, int nthreads, size_t max_runs, size_t *nruns)
+{
+    // Every thread has room for the runs of its own block
+    size_t per_thread = max_runs / (size_t) nthreads + 2;
+    size_t *starts = (size_t *) malloc((size_t) nthreads * per_thread * sizeof(size_t) + sizeof(size_t));
+    size_t *counts = (size_t *) malloc((size_t) nthreads * sizeof(size_t));
+    if (starts == NULL || counts == NULL)
+    {
+        free(starts);
+        free(counts);
+        return NULL;
+    }
+
+    int too_many = 0;
+    size_t total = 0;
+
+#pragma omp parallel num_threads(nthreads)
+    {
+        size_t t = (size_t) omp_get_thread_num();
+        size_t p = (size_t) omp_get_num_threads();
+        size_t begin = block_start(n, p, t);
+        size_t end = block_start(n, p, t + 1);
+
+        counts[t] = SORT_FN(find_runs)(arr, begin, end, starts + t * per_thread, per_thread);
+        if (counts[t] > per_thread)
+        {
+#pragma omp atomic write
+            too_many = 1;
+        }
+
+#pragma omp barrier
+#pragma omp single
+        if (!too_many)
+        {
+            // Concatenate the lists, the first run of a block continues the last one of the block
+            // before it if they are in order
+            for (size_t u = 0; u < p; u++)
+            {
+                const size_t *block_starts = starts + u * per_thread;
+                for (size_t r = 0; r < counts[u]; r++)
+                {
+                    size_t start = block_starts[r];
+                    if (r == 0 && total > 0 && SORT_LEQ(arr, start - 1, arr, start))
+                        continue;
+                    starts[total++] = start;
+                }
+            }
+        }
+    }
+    free(counts);
+
+    if (too_many)
+    {
+        free(starts);
+        return NULL;
+    }
+    starts[total] = n;
+    *nruns = total;
+    return starts;
+}
+
+/**
+ * @brief Index m in starts[a+1..b-1] of the run boundary closest to the middle of the runs a..b-1.
+ */
+static size_t SORT_FN(middle_run)(const size_t *starts, size_t a, size_t b)
+{
+    size_t middle = starts[a] + (starts[b] - starts[a]) / 2;
+    size_t lo = a + 1, hi = b - 1;
+
+    while (lo < hi)
+    {
+        size_t m = lo + (hi - lo) / 2;
+        if (starts[m] < middle)
+            lo = m + 1;
+        else
+            hi = m;
+    }
+    if (lo > a + 1 && middle - starts[lo - 1] < starts[lo] - middle)
+        lo--;
+    return lo;
+}
+
+/**
+ * @brief Merges the runs a..b-1 (arr[starts[a]..starts[b]-1]) from src into dst. Like in
+ * merge_sort_recursive(), both arrays hold the same elements in the range when it is called, and the
+ * runs are split into tasks down to cfg->task_depth levels.
+ * @param: depth = number of task levels above this call
+ */
+static void SORT_FN(merge_natural)(SORT_ARRAY src, SORT_ARRAY dst, const size_t *starts, size_t a, size_t b,
+                                   int depth, const struct sort_config *cfg)
+{
+    if (b - a < 2)
+        return;
+
+    size_t m = SORT_FN(middle_run)(starts, a, b);
+    size_t left = starts[a], mid = starts[m] - 1, right = starts[b] - 1;
+
+    if (right - left < cfg->cutoff || depth >= cfg->task_depth)
+    {
+        SORT_FN(merge_natural)(dst, src, starts, a, m, depth, cfg);
+        SORT_FN(merge_natural)(dst, src, starts, m, b, depth, cfg);
+
+        SORT_FN(merge_sequential)(src, dst, left, mid, right, cfg);
+    } else
+    {
+        STATS_TASK();
+#pragma omp task untied
+        SORT_FN(merge_natural)(dst, src, starts, a, m, depth + 1, cfg);
+
+        SORT_FN(merge_natural)(dst, src, starts, m, b, depth + 1, cfg);
+
+#pragma omp taskwait
+        SORT_FN(merge_parallel)(src, dst, left, mid, right, cfg);
+    }
+}
+
+/**
+ * @brief In-place version of merge_natural(): merges the runs a..b-1 of arr.
+ * @param: depth = number of task levels above this call
+ */
+static void SORT_FN(merge_natural_in_place)(SORT_ARRAY arr, const size_t *starts, size_t a, size_t b,
+                                            SORT_ARRAY bufs, size_t buf_size, int depth,
+                                            const struct sort_config *cfg)
+{
+    if (b - a < 2)
+        return;
+
+    size_t m = SORT_FN(middle_run)(starts, a, b);
+
+    if (starts[b] - starts[a] < cfg->cutoff || depth >= cfg->task_depth)
+    {
+        SORT_FN(merge_natural_in_place)(arr, starts, a, m, bufs, buf_size, depth, cfg);
+        SORT_FN(merge_natural_in_place)(arr, starts, m, b, bufs, buf_size, depth, cfg);
+    } else
+    {
+        STATS_TASK();
+#pragma omp task untied
+        SORT_FN(merge_natural_in_place)(arr, starts, a, m, bufs, buf_size, depth + 1, cfg);
+
+        SORT_FN(merge_natural_in_place)(arr, starts, m, b, bufs, buf_size, depth + 1, cfg);
+
+#pragma omp taskwait
+    }
+    SORT_FN(merge_in_place_parallel)(arr, starts[a], starts[m], starts[b], bufs, buf_size, depth, cfg);
+}
+
+/**
+ * @brief Allocates a scratch array of n elements with the same layout as arr.
+ * @return 0 on success, -1 if the allocation failed
+ */
+static int SORT_FN(scratch_alloc)(SORT_ARRAY arr, SORT_ARRAY *tmp, size_t n)
+{
+#if defined(SORT_GENERIC)
+    *tmp = arr;
+    tmp->base = (char *) malloc(n * arr.size);
+    return tmp->base == NULL ? -1 : 0;
+#elif defined(SORT_PAYLOAD_T)
+    (void) arr;
+    tmp->keys = (SORT_KEY_T *) malloc(n * sizeof(SORT_KEY_T));
+    tmp->values = (SORT_PAYLOAD_T *) malloc(n * sizeof(SORT_PAYLOAD_T));
+    if (tmp->keys == NULL || tmp->values == NULL)
+    {
+        free(tmp->keys);
+        free(tmp->values);
+        return -1;
+    }
+    return 0;
+#else
+    (void) arr;
+    *tmp = (SORT_KEY_T *) malloc(n * sizeof(SORT_KEY_T));
+    return *tmp == NULL ? -1 : 0;
+#endif
+}
+
+static void SORT_FN(scratch_free)(SORT_ARRAY tmp)
+{
+#if defined(SORT_GENERIC)
+    free(tmp.base);
+#elif defined(SORT_PAYLOAD_T)
+    free(tmp.keys);
+    free(tmp.values);
+#else
+    free(tmp);
+#endif
+}
+
+#if defined(SORT_RADIX_KEY) && !defined(SORT_GENERIC)
+
+/******************************************** radix sort ********************************************/
+
+#if defined(SORT_PAYLOAD_T)
+#define SORT_KEYS(a) ((a).keys)
+#else
+#define SORT_KEYS(a) (a)
+#endif
+
+// Keys (and values) per write-combining line
+#define RADIX_WC (RADIX_LINE / sizeof(SORT_KEY_T))
+
+/**
+ * @brief Moves the keys of src[begin..end-1] to their place in dst, by the digit at shift. A
+ * thread's keys with the same digit are consecutive in dst, starting at offsets[digit], so the keys
+ * are collected in one cache line per bucket and written out a whole line at a time. This keeps the
+ * number of destination lines in use small, instead of touching a scattered line for every key.
+ * @param: offsets = position in dst for the next key of each digit, advanced by this function
+ * @param: wc_keys, wc_values = RADIX_BUCKETS * RADIX_WC scratch elements (values only with a payload)
+ */
+static void SORT_FN(radix_scatter)(SORT_ARRAY src, SORT_ARRAY dst, size_t begin, size_t end, int shift,
+                                   size_t *offsets, SORT_KEY_T *wc_keys, void *wc_values)
+{
+    unsigned int fill[RADIX_BUCKETS] = {0};
+#if defined(SORT_PAYLOAD_T)
+    SORT_PAYLOAD_T *wc_vals = (SORT_PAYLOAD_T *) wc_values;
+#else
+    (void) wc_values;
+#endif
+
+    for (size_t i = begin; i < end; i++)
+    {
+        SORT_KEY_T key = SORT_KEYS(src)[i];
+        unsigned int digit = (unsigned int) (SORT_RADIX_KEY(key) >> shift) & (RADIX_BUCKETS - 1);
+        size_t slot = digit * RADIX_WC + fill[digit];
+
+        wc_keys[slot] = key;
+#if defined(SORT_PAYLOAD_T)
+        wc_vals[slot] = src.values[i];
+#endif
+        if (++fill[digit] == RADIX_WC)
+        {
+            memcpy(SORT_KEYS(dst) + offsets[digit], wc_keys + digit * RADIX_WC, RADIX_WC * sizeof(SORT_KEY_T));
+#if defined(SORT_PAYLOAD_T)
+            memcpy(dst.values + offsets[digit], wc_vals + digit * RADIX_WC, RADIX_WC * sizeof(SORT_PAYLOAD_T));
+#endif
+            offsets[digit] += RADIX_WC;
+            fill[digit] = 0;
+        }
+    }
+
+    // Write out the partly filled lines
+    for (unsigned int digit = 0; digit < RADIX_BUCKETS; digit++)
+    {
+        memcpy(SORT_KEYS(dst) + offsets[digit], wc_keys + digit * RADIX_WC, fill[digit] * sizeof(SORT_KEY_T));
+#if defined(SORT_PAYLOAD_T)
+        memcpy(dst.values + offsets[digit], wc_vals + digit * RADIX_WC, fill[digit] * sizeof(SORT_PAYLOAD_T));
+#endif
+        offsets[digit] += fill[digit];
+    }
+}
+
+/**
+ * @brief Sorts arr[0..n-1] with a parallel LSD radix sort, RADIX_BITS bits per pass. In every pass,
+ * each thread counts the digits of its own block, the counts are turned into the start offsets of
+ * every (digit, thread) pair with a prefix sum, and each thread moves its keys to tmp. Blocks are
+ * assigned to threads in order, so the sort is stable. Passes in which all keys have the same digit
+ * are skipped, so keys with a small range take fewer passes.
+ * @param: tmp = scratch array of n elements
+ * @return 0 on success, -1 if the per-thread buffers could not be allocated
+ */
+static int SORT_FN(radix_sort)(SORT_ARRAY arr, SORT_ARRAY tmp, size_t n, int nthreads)
+{
+    size_t *counts = (size_t *) malloc((size_t) nthreads * RADIX_BUCKETS * sizeof(size_t));
+    size_t line_bytes = RADIX_BUCKETS * RADIX_WC * sizeof(SORT_KEY_T);
+#if defined(SORT_PAYLOAD_T)
+    line_bytes += RADIX_BUCKETS * RADIX_WC * sizeof(SORT_PAYLOAD_T);
+#endif
+    char *lines = (char *) aligned_alloc(RADIX_LINE, (size_t) nthreads * line_bytes);
+    if (counts == NULL || lines == NULL)
+    {
+        free(counts);
+        free(lines);
+        return -1;
+    }
+
+    SORT_ARRAY src = arr, dst = tmp;
+    int skip = 0;
+
+#pragma omp parallel num_threads(nthreads)
+    {
+        int t = omp_get_thread_num();
+        int p = omp_get_num_threads();
+        size_t begin = n / p * t + n % p * t / p;
+        size_t end = n / p * (t + 1) + n % p * (t + 1) / p;
+        size_t *my_counts = counts + (size_t) t * RADIX_BUCKETS;
+        SORT_KEY_T *wc_keys = (SORT_KEY_T *) (lines + (size_t) t * line_bytes);
+        void *wc_values = wc_keys + RADIX_BUCKETS * RADIX_WC;
+
+        for (int shift = 0; shift < (int) (8 * sizeof(SORT_RADIX_T)); shift += RADIX_BITS)
+        {
+            STATS_START(histogram_start);
+            memset(my_counts, 0, RADIX_BUCKETS * sizeof(size_t));
+            for (size_t i = begin; i < end; i++)
+                my_counts[(SORT_RADIX_KEY(SORT_KEYS(src)[i]) >> shift) & (RADIX_BUCKETS - 1)]++;
+            STATS_RADIX_HISTOGRAM(histogram_start);
+
+#pragma omp barrier
+#pragma omp single
+            {
+                // Every digit gets the keys of thread 0, then thread 1, ...
+                size_t offset = 0;
+                skip = 0;
+                for (int digit = 0; digit < RADIX_BUCKETS && !skip; digit++)
+                {
+                    size_t total = 0;
+                    for (int u = 0; u < p; u++)
+                    {
+                        size_t count = counts[(size_t) u * RADIX_BUCKETS + digit];
+                        counts[(size_t) u * RADIX_BUCKETS + digit] = offset + total;
+                        total += count;
+                    }
+                    skip = total == n;
+                    offset += total;
+                }
+            }
+
+            if (!skip)
+            {
+                STATS_START(scatter_start);
+                SORT_FN(radix_scatter)(src, dst, begin, end, shift, my_counts, wc_keys, wc_values);
+                STATS_RADIX_SCATTER(scatter_start);
+            }
+
+#pragma omp barrier
+#pragma omp single
+            if (!skip)
+            {
+                STATS_RADIX_PASS();
+                SORT_ARRAY swap = src;
+                src = dst;
+                dst = swap;
+            }
+        }
+
+        // After an odd number of passes, the sorted keys are in tmp
+        if (SORT_KEYS(src) != SORT_KEYS(arr))
+        {
+            STATS_START(copy_start);
+#pragma omp for nowait
+            for (size_t i = 0; i < n; i++)
+                SORT_MOVE(arr, i, src, i);
+            STATS_COPY(copy_start, t == 0 ? n : 0);
+        }
+    }
+
+    free(counts);
+    free(lines);
+    return 0;
+}
+
+#undef SORT_KEYS
+#undef RADIX_WC
+
+#endif // SORT_RADIX_KEY
+
+/******************************************** samplesort ********************************************/
+
+/**
+ * @brief Number of splitters in spl[0..count-1] that are not greater than a[i], which is the
+ * bucket of a[i]. Equal elements always get the same bucket.
+ */
+static inline size_t SORT_FN(find_bucket)(SORT_ARRAY spl, size_t count, SORT_ARRAY a, size_t i)
+{
+    size_t lo = 0;
+    while (count > 0)
+    {
+        size_t half = count / 2;
+        if (SORT_LEQ(spl, lo + half, a, i))
+        {
+            lo += half + 1;
+            count -= half + 1;
+        } else
+            count = half;
+    }
+    return lo;
+}
+
+/**
+ * @brief Sorts arr[0..n-1] with a parallel samplesort. nbuckets - 1 splitters are chosen from a
+ * sorted sample of SAMPLE_OVERSAMPLE elements per bucket. Every thread counts how many elements of
+ * its own block fall into each bucket, a prefix sum over these counts gives every (bucket, thread)
+ * pair its place in tmp, and the threads move their elements there. Then each bucket is sorted
+ * back into arr with merge_sort_recursive() in its own task. Apart from the sample, the whole
+ * array is only read and written about three times before the buckets are sorted in cache-sized
+ * pieces, instead of once per level of the merge tree. Blocks are assigned to threads in order,
+ * so the sort is stable.
+ * @param: tmp = scratch array of n elements
+ * @param: nbuckets = number of buckets, at least 1
+ * @return 0 on success, -1 if the sample or the counters could not be allocated
+ */
+static int SORT_FN(samplesort)(SORT_ARRAY arr, SORT_ARRAY tmp, size_t n, int nbuckets, int nthreads,
+                               const struct sort_config *cfg)
+{
+    size_t nsample = (size_t) nbuckets * SAMPLE_OVERSAMPLE;
+    size_t nsplitters = (size_t) nbuckets - 1;
+    size_t stride = n / nsample;    // the caller makes sure it is at least 1
+
+    // The sample, a copy of it as scratch space for sorting it, and the splitters
+    SORT_ARRAY sample;
+    if (SORT_FN(scratch_alloc)(arr, &sample, 2 * nsample + nsplitters) != 0)
+        return -1;
+    SORT_ARRAY sample_tmp = SORT_AT(sample, nsample);
+    SORT_ARRAY spl = SORT_AT(sample, 2 * nsample);
+
+    // counts[t * nbuckets + b]: elements of thread t's block in bucket b, and later their offset
+    size_t *counts = (size_t *) malloc((size_t) nthreads * nbuckets * sizeof(size_t));
+    size_t *bucket_start = (size_t *) malloc(((size_t) nbuckets + 1) * sizeof(size_t));
+    if (counts == NULL || bucket_start == NULL)
+    {
+        free(counts);
+        free(bucket_start);
+        SORT_FN(scratch_free)(sample);
+        return -1;
+    }
+
+    // One element from every stride, at a varying position within it
+    for (size_t i = 0; i < nsample; i++)
+    {
+        size_t index = i * stride + (i * 40503u) % stride;
+        SORT_MOVE(sample, i, arr, index);
+        SORT_MOVE(sample_tmp, i, arr, index);
+    }
+
+#pragma omp parallel num_threads(nthreads)
+    {
+        int t = omp_get_thread_num();
+        int p = omp_get_num_threads();
+        size_t begin = n / p * t + n % p * t / p;
+        size_t end = n / p * (t + 1) + n % p * (t + 1) / p;
+        size_t *my_counts = counts + (size_t) t * nbuckets;
+
+#pragma omp single
+        {
+            SORT_FN(merge_sort_recursive)(sample_tmp, sample, 0, nsample - 1, 0, cfg);
+            for (size_t b = 0; b < nsplitters; b++)
+                SORT_MOVE(spl, b, sample, (b + 1) * SAMPLE_OVERSAMPLE);
+        }
+
+        memset(my_counts, 0, (size_t) nbuckets * sizeof(size_t));
+        for (size_t i = begin; i < end; i++)
+            my_counts[SORT_FN(find_bucket)(spl, nsplitters, arr, i)]++;
+
+#pragma omp barrier
+#pragma omp single
+        {
+            // Every bucket gets the elements of thread 0, then thread 1, ...
+            size_t offset = 0;
+            for (int b = 0; b < nbuckets; b++)
+            {
+                bucket_start[b] = offset;
+                for (int u = 0; u < p; u++)
+                {
+                    size_t count = counts[(size_t) u * nbuckets + b];
+                    counts[(size_t) u * nbuckets + b] = offset;
+                    offset += count;
+                }
+            }
+            bucket_start[nbuckets] = offset;
+        }
+
+        for (size_t i = begin; i < end; i++)
+        {
+            size_t b = SORT_FN(find_bucket)(spl, nsplitters, arr, i);
+            SORT_MOVE(tmp, my_counts[b], arr, i);
+            my_counts[b]++;
+        }
+
+#pragma omp barrier
+#pragma omp single
+        {
+            // A bucket with many equal elements can be much larger than the others, it is then
+            // split up further by the tasks of merge_sort_recursive()
+            for (int b = 0; b < nbuckets; b++)
+            {
+                size_t first = bucket_start[b], last = bucket_start[b + 1];
+                if (last == first)
+                    continue;
+#pragma omp task firstprivate(first, last)
+                {
+                    for (size_t i = first; i < last; i++)
+                        SORT_MOVE(arr, i, tmp, i);
+                    SORT_FN(merge_sort_recursive)(tmp, arr, first, last - 1, ceil_log2((size_t) nbuckets), cfg);
+                }
+            }
+        }
+    }
+
+    free(counts);
+    free(bucket_start);
+    SORT_FN(scratch_free)(sample);
+    return 0;
+}
+
+/**
+ * @brief Sorts arr[0..n-1], see parallel_merge_sort_opts() in parallel_merge_sort.h.
+ */
+static int SORT_FN(sort_dispatch)(SORT_ARRAY arr, size_t n, const struct merge_sort_options *opts)
+{
+    if (opts == NULL)
+        opts = &merge_sort_default_options;
+
+    if (n < 2)
+        return 0;
+
+    int nthreads = opts->nthreads > 0 ? opts->nthreads : omp_get_max_threads();
+
+    struct sort_config cfg;
+    cfg.branchless = opts->kernel != MERGE_SORT_BRANCHY;
+    cfg.cutoff = merge_sort_resolve_cutoff(opts->cutoff, nthreads);
+    cfg.kway = merge_sort_resolve_kway(opts->kway);
+    cfg.task_depth = ceil_log2((size_t) nthreads) + TASK_DEPTH_SLACK;
+
+    // For MERGE_SORT_IN_PLACE: one small buffer per thread, indexed by omp_get_thread_num(), of at least
+    // sqrt(n) elements. Not smaller than the cutoff, so all merges of the sequential leaves go through it.
+    size_t buf_size = cfg.cutoff;
+    while (buf_size < n / buf_size)
+        buf_size *= 2;
+
+    // Runs that are already sorted, NULL if the array is sorted from scratch. A forced radix sort or
+    // samplesort is not replaced by a natural merge, unless that is asked for with
+    // MERGE_SORT_ADAPTIVE_ALWAYS.
+    size_t nruns = 0;
+    size_t *runs = NULL;
+    int merge_algorithm = opts->algorithm == MERGE_SORT_AUTO || opts->algorithm == MERGE_SORT_MERGE;
+    if (opts->adaptive == MERGE_SORT_ADAPTIVE_ALWAYS)
+    {
+        size_t max_runs = opts->memory == MERGE_SORT_IN_PLACE ? (size_t) nthreads * buf_size
+                                                             : n / ADAPTIVE_ALWAYS_MIN_RUN;
+        runs = SORT_FN(detect_runs)(arr, n, nthreads, max_runs, &nruns);
+    } else if (opts->adaptive == MERGE_SORT_ADAPTIVE_AUTO && merge_algorithm)
+        runs = SORT_FN(detect_runs)(arr, n, nthreads, n / ADAPTIVE_MIN_RUN, &nruns);
+    if (runs != NULL && nruns == 1)
+    {
+        free(runs);
+        return 0;
+    }
+
+    if (opts->memory == MERGE_SORT_IN_PLACE)
+    {
+        SORT_ARRAY bufs;
+        if (SORT_FN(scratch_alloc)(arr, &bufs, (size_t) nthreads * buf_size) != 0)
+        {
+            free(runs);
+            return -1;
+        }
+
+#pragma omp parallel num_threads(nthreads)
+        {
+#pragma omp single
+            if (runs != NULL)
+                SORT_FN(merge_natural_in_place)(arr, runs, 0, nruns, bufs, buf_size, 0, &cfg);
+            else
+                SORT_FN(merge_sort_in_place)(arr, 0, n, bufs, buf_size, 0, &cfg);
+        }
+
+        SORT_FN(scratch_free)(bufs);
+        free(runs);
+        return 0;
+    }
+
+    // Scratch array for the whole sort, the merges alternate between it and arr
+    SORT_ARRAY tmp;
+    if (SORT_FN(scratch_alloc)(arr, &tmp, n) != 0)
+    {
+        free(runs);
+        return -1;
+    }
+
+    if (runs != NULL)
+    {
+#pragma omp parallel num_threads(nthreads)
+        {
+#pragma omp for
+            for (size_t i = 0; i < n; i++)
+                SORT_MOVE(tmp, i, arr, i);
+
+#pragma omp single
+            SORT_FN(merge_natural)(tmp, arr, runs, 0, nruns, 0, &cfg);
+        }
+
+        SORT_FN(scratch_free)(tmp);
+        free(runs);
+        return 0;
+    }
+
+    // Too small for a sample of SAMPLE_OVERSAMPLE elements per bucket, the merge sort is used then
+    int nbuckets = nthreads;
+    if (opts->algorithm == MERGE_SORT_SAMPLE && n / SAMPLE_OVERSAMPLE >= 2 * (size_t) nbuckets)
+    {
+        int ret = SORT_FN(samplesort)(arr, tmp, n, nbuckets, nthreads, &cfg);
+        SORT_FN(scratch_free)(tmp);
+        return ret;
+    }
+
+#if defined(SORT_RADIX_KEY) && !defined(SORT_GENERIC)
+    if (opts->algorithm == MERGE_SORT_RADIX || (opts->algorithm == MERGE_SORT_AUTO && n >= RADIX_MIN_N))
+    {
+        int ret = SORT_FN(radix_sort)(arr, tmp, n, nthreads);
+        SORT_FN(scratch_free)(tmp);
+        return ret;
+    }
+#endif
+
+    // Fixed blocks per thread pay off when memory is spread over several nodes, and need blocks of
+    // at least the cutoff
+    int local = opts->placement == MERGE_SORT_PLACE_LOCAL ||
+                (opts->placement == MERGE_SORT_PLACE_AUTO && merge_sort_numa_nodes() > 1);
+    if (local && nthreads > 1 && n / (size_t) nthreads >= cfg.cutoff)
+    {
+        // spread places the threads over the nodes, so the blocks are spread as well
+#pragma omp parallel num_threads(nthreads) proc_bind(spread)
+        SORT_FN(merge_sort_blocks)(arr, tmp, n, &cfg);
+
+        SORT_FN(scratch_free)(tmp);
+        return 0;
+    }
+
+    // The team is created once for the whole sort. One thread creates the task tree, the others
+    // execute the tasks it spawns.
+#pragma omp parallel num_threads(nthreads)
+    {
+        STATS_START(copy_start);
+#pragma omp for nowait
+        for (size_t i = 0; i < n; i++)
+            SORT_MOVE(tmp, i, arr, i);
+        STATS_COPY(copy_start, omp_get_thread_num() == 0 ? n : 0);
+#pragma omp barrier
+
+#pragma omp single
+        if (cfg.kway > 2)
+            SORT_FN(merge_sort_kway)(tmp, arr, 0, n - 1, 0, &cfg);
+        else
+            SORT_FN(merge_sort_recursive)(tmp, arr, 0, n - 1, 0, &cfg);
+    }
+
+    SORT_FN(scratch_free)(tmp);
+    return 0;
+}
+
+/**
+ * @brief Sorts arr[0..n-1] with the options, see SORT_FN(sort_dispatch)(). Counted as one sort in the
+ * statistics (MERGE_SORT_STATS).
+ */
+static int SORT_FN(sort)(SORT_ARRAY arr, size_t n, const struct merge_sort_options *opts)
+{
+    STATS_START(sort_start);
+    int ret = SORT_FN(sort_dispatch)(arr, n, opts);
+    STATS_SORT(sort_start);
+    return ret;
+}
+
+#undef SORT_ARRAY
+#undef SORT_LEQ
+#undef SORT_MOVE
+#undef SORT_SWAP
+#undef SORT_AT
+#undef SORT_LESS
+#undef SORT_LEAF
+#undef SORT_LEAF_MAX
+#undef SORT_RADIX_T
+#undef SORT_RADIX_KEY
+#undef SORT_NAME
+#undef SORT_KEY_T
+#undef SORT_PAYLOAD_T
+#undef SORT_GENERIC
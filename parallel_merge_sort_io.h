@@ -0,0 +1,440 @@
+/****************************************************************************************************
+ Input and output of the sort program (main in parallel_merge_sort.c):
+
+ Keys are read from a file or from stdin ("-"), either binary (native-endian int32) or as text
+ (decimal numbers separated by whitespace), and written the same ways. Binary files are read with
+ one pread() per thread into the thread's block of the array, so the pages are placed like the
+ sort uses them. Text is read into memory first and parsed in parallel: the text is cut into one
+ piece per thread at whitespace, every thread counts the numbers in its piece, a prefix sum gives
+ each piece its place in the array, and then every thread parses its piece. Text output is
+ formatted in parallel as well, by batches that every thread formats into its own buffer, which
+ are then written in order.
+ ****************************************************************************************************/
+
+#ifndef PARALLEL_MERGE_SORT_IO_H
+#define PARALLEL_MERGE_SORT_IO_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <omp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "parallel_merge_sort.h"
+
+// Keys formatted per thread and batch when writing text
+#define IO_TEXT_BATCH (1 << 16)
+
+// Longest formatted key: "-2147483648\n"
+#define IO_TEXT_KEY_MAX 12
+
+enum io_format
+{
+    IO_BINARY,
+    IO_TEXT,
+};
+
+static int io_is_space(char c)
+{
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/**
+ * @brief Opens path for reading, "-" is stdin.
+ */
+static int io_open_input(const char *path)
+{
+    return strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+}
+
+/**
+ * @brief Opens path for writing, "-" is stdout.
+ */
+static int io_open_output(const char *path)
+{
+    return strcmp(path, "-") == 0 ? STDOUT_FILENO : open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+}
+
+static void io_close(int fd)
+{
+    if (fd != STDIN_FILENO && fd != STDOUT_FILENO)
+        close(fd);
+}
+
+/**
+ * @brief Writes all bytes of buf to fd.
+ * @return 0 on success, -1 on error
+ */
+static int io_write_all(int fd, const void *buf, size_t bytes)
+{
+    const char *p = (const char *) buf;
+    while (bytes > 0)
+    {
+        ssize_t done = write(fd, p, bytes);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done < 0)
+            return -1;
+        p += done;
+        bytes -= (size_t) done;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads fd up to its end into a buffer that grows as needed (for pipes and text).
+ * @param: buf = set to the data, to be freed by the caller. One byte after the data is allocated.
+ * @return 0 on success, -1 on error
+ */
+static int io_read_all(int fd, char **buf, size_t *len)
+{
+    struct stat st;
+    size_t capacity = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) ? (size_t) st.st_size + 1 : (1 << 20);
+    size_t used = 0;
+    char *data = (char *) malloc(capacity);
+    if (data == NULL)
+        return -1;
+
+    for (;;)
+    {
+        if (used + 1 >= capacity)
+        {
+            char *grown = (char *) realloc(data, capacity * 2);
+            if (grown == NULL)
+            {
+                free(data);
+                return -1;
+            }
+            data = grown;
+            capacity *= 2;
+        }
+        ssize_t done = read(fd, data + used, capacity - used - 1);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done < 0)
+        {
+            free(data);
+            return -1;
+        }
+        if (done == 0)
+            break;
+        used += (size_t) done;
+    }
+    *buf = data;
+    *len = used;
+    return 0;
+}
+
+/**
+ * @brief Reads binary keys. A regular file is read in parallel, straight into the threads' blocks.
+ * @return 0 on success, -1 on error (EINVAL if the size is not a multiple of 4)
+ */
+static int io_read_binary(const char *path, int nthreads, int32_t **arr, size_t *n)
+{
+    int fd = io_open_input(path);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        // A pipe, read it as a stream
+        char *data;
+        size_t len;
+        int ret = io_read_all(fd, &data, &len);
+        io_close(fd);
+        if (ret != 0)
+            return -1;
+        if (len % sizeof(int32_t) != 0)
+        {
+            free(data);
+            errno = EINVAL;
+            return -1;
+        }
+        *arr = (int32_t *) data;
+        *n = len / sizeof(int32_t);
+        return 0;
+    }
+
+    if (st.st_size % (off_t) sizeof(int32_t) != 0)
+    {
+        io_close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    size_t count = (size_t) st.st_size / sizeof(int32_t);
+    int32_t *keys = (int32_t *) merge_sort_alloc_local(count, sizeof(int32_t), nthreads);
+    if (keys == NULL)
+    {
+        io_close(fd);
+        return -1;
+    }
+
+    int failed = 0;
+    int saved = 0;
+#pragma omp parallel num_threads(nthreads > 0 ? nthreads : omp_get_max_threads()) proc_bind(spread)
+    {
+        size_t t = (size_t) omp_get_thread_num();
+        size_t p = (size_t) omp_get_num_threads();
+        size_t begin = block_start(count, p, t);
+        size_t end = block_start(count, p, t + 1);
+
+        off_t offset = (off_t) (begin * sizeof(int32_t));
+        if (ext_transfer(fd, keys + begin, (end - begin) * sizeof(int32_t), offset, 0) != 0)
+        {
+#pragma omp critical(merge_sort_io)
+            {
+                failed = 1;
+                saved = errno;
+            }
+        }
+    }
+    io_close(fd);
+
+    if (failed)
+    {
+        free(keys);
+        errno = saved;
+        return -1;
+    }
+    *arr = keys;
+    *n = count;
+    return 0;
+}
+
+/**
+ * @brief Parses the number that starts at text[*pos] and moves *pos behind it.
+ * @return 0 on success, -1 if it is not a number in the range of int32_t
+ */
+static int io_parse_key(const char *text, size_t len, size_t *pos, int32_t *key)
+{
+    size_t i = *pos;
+    int negative = 0;
+    if (text[i] == '-' || text[i] == '+')
+    {
+        negative = text[i] == '-';
+        i++;
+    }
+
+    size_t first_digit = i;
+    int64_t value = 0;
+    while (i < len && text[i] >= '0' && text[i] <= '9')
+    {
+        value = value * 10 + (text[i] - '0');
+        if (value > (int64_t) INT32_MAX + 1)
+            return -1;
+        i++;
+    }
+    if (i == first_digit || (i < len && !io_is_space(text[i])))
+        return -1;
+
+    value = negative ? -value : value;
+    if (value > INT32_MAX)
+        return -1;
+    *key = (int32_t) value;
+    *pos = i;
+    return 0;
+}
+
+/**
+ * @brief Reads keys as text, see above.
+ * @return 0 on success, -1 on error (EINVAL if there is something else than numbers, with the
+ * offset of the first bad byte in *bad)
+ */
+static int io_read_text(const char *path, int nthreads, int32_t **arr, size_t *n, size_t *bad)
+{
+    int fd = io_open_input(path);
+    if (fd < 0)
+        return -1;
+
+    char *text;
+    size_t len;
+    int ret = io_read_all(fd, &text, &len);
+    io_close(fd);
+    if (ret != 0)
+        return -1;
+
+    if (nthreads <= 0)
+        nthreads = omp_get_max_threads();
+    size_t *piece = (size_t *) malloc(((size_t) nthreads + 1) * sizeof(size_t));
+    size_t *offset = (size_t *) malloc(((size_t) nthreads + 1) * sizeof(size_t));
+    int32_t *keys = NULL;
+    size_t first_bad = SIZE_MAX;
+    size_t count = 0;
+
+    if (piece == NULL || offset == NULL)
+    {
+        free(piece);
+        free(offset);
+        free(text);
+        return -1;
+    }
+
+    int team = nthreads;
+#pragma omp parallel num_threads(nthreads)
+    {
+        size_t t = (size_t) omp_get_thread_num();
+        size_t p = (size_t) omp_get_num_threads();
+
+        // Every piece starts at the beginning of a number, or at the end of the text
+        size_t start = block_start(len, p, t);
+        while (start > 0 && start < len && !io_is_space(text[start - 1]))
+            start++;
+        piece[t] = start;
+        if (t == p - 1)
+        {
+            piece[p] = len;
+            team = (int) p;
+        }
+
+#pragma omp barrier
+        size_t end = piece[t + 1] > start ? piece[t + 1] : start;
+        size_t tokens = 0;
+        for (size_t i = start; i < end; i++)
+            tokens += !io_is_space(text[i]) && (i == 0 || io_is_space(text[i - 1]));
+        offset[t + 1] = tokens;
+    }
+
+    offset[0] = 0;
+    for (int u = 0; u < team; u++)
+        offset[u + 1] += offset[u];
+    count = offset[team];
+    keys = (int32_t *) merge_sort_alloc_local(count, sizeof(int32_t), team);
+
+    if (keys != NULL)
+    {
+#pragma omp parallel num_threads(team)
+        {
+            size_t t = (size_t) omp_get_thread_num();
+            size_t end = piece[t + 1] > piece[t] ? piece[t + 1] : piece[t];
+            size_t k = offset[t];
+            size_t i = piece[t];
+
+            while (i < end)
+            {
+                if (io_is_space(text[i]))
+                {
+                    i++;
+                    continue;
+                }
+                if (io_parse_key(text, len, &i, &keys[k]) != 0)
+                {
+#pragma omp critical(merge_sort_io)
+                    if (i < first_bad)
+                        first_bad = i;
+                    break;
+                }
+                k++;
+            }
+        }
+    }
+
+    free(piece);
+    free(offset);
+    free(text);
+
+    if (keys == NULL)
+        return -1;
+    if (first_bad != SIZE_MAX)
+    {
+        free(keys);
+        *bad = first_bad;
+        errno = EINVAL;
+        return -1;
+    }
+    *arr = keys;
+    *n = count;
+    return 0;
+}
+
+/**
+ * @brief Writes the keys to path in binary.
+ * @return 0 on success, -1 on error
+ */
+static int io_write_binary(const char *path, const int32_t *arr, size_t n)
+{
+    int fd = io_open_output(path);
+    if (fd < 0)
+        return -1;
+
+    int ret = io_write_all(fd, arr, n * sizeof(int32_t));
+    if (fd != STDOUT_FILENO && close(fd) != 0)
+        ret = -1;
+    return ret;
+}
+
+/**
+ * @brief Formats key followed by a newline at out.
+ * @return the number of bytes written
+ */
+static size_t io_format_key(int32_t key, char *out)
+{
+    char digits[10];
+    size_t len = 0;
+    size_t pos = 0;
+    uint32_t value = key < 0 ? 0u - (uint32_t) key : (uint32_t) key;
+
+    do
+    {
+        digits[len++] = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+
+    if (key < 0)
+        out[pos++] = '-';
+    while (len > 0)
+        out[pos++] = digits[--len];
+    out[pos++] = '\n';
+    return pos;
+}
+
+/**
+ * @brief Writes the keys to path as text, one per line.
+ * @return 0 on success, -1 on error
+ */
+static int io_write_text(const char *path, const int32_t *arr, size_t n, int nthreads)
+{
+    int fd = io_open_output(path);
+    if (fd < 0)
+        return -1;
+
+    if (nthreads <= 0)
+        nthreads = omp_get_max_threads();
+    char *bufs = (char *) malloc((size_t) nthreads * IO_TEXT_BATCH * IO_TEXT_KEY_MAX);
+    size_t *used = (size_t *) malloc((size_t) nthreads * sizeof(size_t));
+    int ret = bufs != NULL && used != NULL ? 0 : -1;
+
+    int team = 1;
+    for (size_t first = 0; first < n && ret == 0; first += (size_t) team * IO_TEXT_BATCH)
+    {
+#pragma omp parallel num_threads(nthreads)
+        {
+            size_t t = (size_t) omp_get_thread_num();
+#pragma omp single
+            team = omp_get_num_threads();
+
+            size_t begin = first + t * IO_TEXT_BATCH;
+            size_t end = begin + IO_TEXT_BATCH < n ? begin + IO_TEXT_BATCH : n;
+            char *out = bufs + t * IO_TEXT_BATCH * IO_TEXT_KEY_MAX;
+            size_t pos = 0;
+            for (size_t i = begin; i < end; i++)
+                pos += io_format_key(arr[i], out + pos);
+            used[t] = pos;
+        }
+
+        for (int t = 0; t < team && ret == 0; t++)
+            ret = io_write_all(fd, bufs + (size_t) t * IO_TEXT_BATCH * IO_TEXT_KEY_MAX, used[t]);
+    }
+
+    free(bufs);
+    free(used);
+    if (fd != STDOUT_FILENO && close(fd) != 0)
+        ret = -1;
+    return ret;
+}
+
+#endif // PARALLEL_MERGE_SORT_IO_H
@@ -0,0 +1,422 @@
+/****************************************************************************************************
+ SIMD kernels for the sequential leaf of the int32 sort:
+
+ Sub-arrays of at most SIMD_LEAF_MAX elements are not split any further, but sorted in vector
+ registers. The block is loaded into registers (padded with INT32_MAX), every register is sorted on
+ its own with an in-register bitonic sorting network, and the sorted registers are combined with
+ bitonic merges: 1+1, 2+2, ... registers. There are no data dependent branches, so this does not
+ suffer from the branch mispredictions of the scalar merge on random keys.
+
+ One kernel is compiled per instruction set (AVX-512F, AVX2, NEON), the one used is chosen at run
+ time by simd_select_leaf() from what the CPU supports. Setting the environment variable
+ MERGE_SORT_SIMD to avx512, avx2, neon or scalar caps the choice (scalar disables the kernels).
+ The kernels are not stable, so they are only used for plain keys, where that can't be observed.
+ ****************************************************************************************************/
+
+#ifndef PARALLEL_MERGE_SORT_SIMD_H
+#define PARALLEL_MERGE_SORT_SIMD_H
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON)
+#define SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+// Largest block a leaf kernel sorts
+#define SIMD_LEAF_MAX 64
+
+typedef void (*simd_leaf_fn)(int32_t *arr, size_t n);
+
+/**
+ * @brief Number of registers of width lanes needed for n elements, rounded up to a power of two
+ */
+static inline int simd_registers(size_t n, int lanes)
+{
+    int regs = 1;
+    while ((size_t) regs * lanes < n)
+        regs *= 2;
+    return regs;
+}
+
+#ifdef SIMD_X86
+
+/************************************************ AVX2 ************************************************/
+
+/**
+ * @brief Compare-exchange of every lane i with lane i ^ j. A lane keeps the larger element if
+ * exactly one of the bits j and k is set in its index, so k selects the sort direction of blocks of
+ * k lanes (k = 8 sorts the whole register ascending).
+ */
+__attribute__((target("avx2"))) static inline __m256i exchange_avx2(__m256i v, int j, int k)
+{
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i zero = _mm256_setzero_si256();
+
+    __m256i partner = _mm256_permutevar8x32_epi32(v, _mm256_xor_si256(lane, _mm256_set1_epi32(j)));
+    __m256i lo = _mm256_min_epi32(v, partner);
+    __m256i hi = _mm256_max_epi32(v, partner);
+    __m256i take_hi = _mm256_xor_si256(_mm256_cmpeq_epi32(_mm256_and_si256(lane, _mm256_set1_epi32(j)), zero),
+                                       _mm256_cmpeq_epi32(_mm256_and_si256(lane, _mm256_set1_epi32(k)), zero));
+    return _mm256_blendv_epi8(lo, hi, take_hi);
+}
+
+__attribute__((target("avx2"))) static inline __m256i sort_register_avx2(__m256i v)
+{
+#pragma GCC unroll 16
+    for (int k = 2; k <= 8; k *= 2)
+#pragma GCC unroll 16
+        for (int j = k / 2; j > 0; j /= 2)
+            v = exchange_avx2(v, j, k);
+    return v;
+}
+
+/**
+ * @brief Merges the sorted sequences r[0..m-1] and r[m..2m-1] into the sorted sequence r[0..2m-1]
+ */
+__attribute__((target("avx2"))) static inline void merge_registers_avx2(__m256i *r, int m)
+{
+    const __m256i reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+
+    // Reversing the second sequence makes the whole one bitonic
+#pragma GCC unroll 16
+    for (int i = 0; i < m / 2; i++)
+    {
+        __m256i t = r[m + i];
+        r[m + i] = r[2 * m - 1 - i];
+        r[2 * m - 1 - i] = t;
+    }
+#pragma GCC unroll 16
+    for (int i = m; i < 2 * m; i++)
+        r[i] = _mm256_permutevar8x32_epi32(r[i], reverse);
+
+    // Half-cleaners between registers, then inside every register
+#pragma GCC unroll 16
+    for (int s = m; s > 0; s /= 2)
+#pragma GCC unroll 16
+        for (int i = 0; i < 2 * m; i += 2 * s)
+#pragma GCC unroll 16
+            for (int j = i; j < i + s; j++)
+            {
+                __m256i lo = _mm256_min_epi32(r[j], r[j + s]);
+                r[j + s] = _mm256_max_epi32(r[j], r[j + s]);
+                r[j] = lo;
+            }
+#pragma GCC unroll 16
+    for (int i = 0; i < 2 * m; i++)
+#pragma GCC unroll 16
+        for (int j = 4; j > 0; j /= 2)
+            r[i] = exchange_avx2(r[i], j, 8);
+}
+
+/**
+ * @brief Sorts buf[0..regs*8-1] in registers, regs is a compile time constant after inlining
+ */
+__attribute__((target("avx2"), always_inline)) static inline void sort_block_avx2(int32_t *buf, int regs)
+{
+    __m256i r[SIMD_LEAF_MAX / 8];
+
+#pragma GCC unroll 16
+    for (int i = 0; i < regs; i++)
+        r[i] = sort_register_avx2(_mm256_load_si256((const __m256i *) (buf + 8 * i)));
+#pragma GCC unroll 16
+    for (int m = 1; m < regs; m *= 2)
+#pragma GCC unroll 16
+        for (int i = 0; i < regs; i += 2 * m)
+            merge_registers_avx2(r + i, m);
+#pragma GCC unroll 16
+    for (int i = 0; i < regs; i++)
+        _mm256_store_si256((__m256i *) (buf + 8 * i), r[i]);
+}
+
+__attribute__((target("avx2"))) static void leaf_sort_avx2(int32_t *arr, size_t n)
+{
+    int32_t buf[SIMD_LEAF_MAX] __attribute__((aligned(32)));
+    int regs = simd_registers(n, 8);
+
+    for (int i = 0; i < regs * 8; i++)
+        buf[i] = INT32_MAX;
+    memcpy(buf, arr, n * sizeof(int32_t));
+
+    // One fully unrolled network per block size
+    switch (regs)
+    {
+        case 1:
+            sort_block_avx2(buf, 1);
+            break;
+        case 2:
+            sort_block_avx2(buf, 2);
+            break;
+        case 4:
+            sort_block_avx2(buf, 4);
+            break;
+        case 8:
+            sort_block_avx2(buf, 8);
+            break;
+    }
+
+    memcpy(arr, buf, n * sizeof(int32_t));
+}
+
+/********************************************** AVX-512 ***********************************************/
+
+__attribute__((target("avx512f"))) static inline __m512i exchange_avx512(__m512i v, int j, int k)
+{
+    const __m512i lane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m512i zero = _mm512_setzero_si512();
+
+    __m512i partner = _mm512_permutexvar_epi32(_mm512_xor_si512(lane, _mm512_set1_epi32(j)), v);
+    __m512i lo = _mm512_min_epi32(v, partner);
+    __m512i hi = _mm512_max_epi32(v, partner);
+    __mmask16 take_hi = _mm512_cmpneq_epi32_mask(_mm512_and_si512(lane, _mm512_set1_epi32(j)), zero)
+                        ^ _mm512_cmpneq_epi32_mask(_mm512_and_si512(lane, _mm512_set1_epi32(k)), zero);
+    return _mm512_mask_blend_epi32(take_hi, lo, hi);
+}
+
+__attribute__((target("avx512f"))) static inline __m512i sort_register_avx512(__m512i v)
+{
+#pragma GCC unroll 16
+    for (int k = 2; k <= 16; k *= 2)
+#pragma GCC unroll 16
+        for (int j = k / 2; j > 0; j /= 2)
+            v = exchange_avx512(v, j, k);
+    return v;
+}
+
+__attribute__((target("avx512f"))) static inline void merge_registers_avx512(__m512i *r, int m)
+{
+    const __m512i reverse = _mm512_setr_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+
+#pragma GCC unroll 16
+    for (int i = 0; i < m / 2; i++)
+    {
+        __m512i t = r[m + i];
+        r[m + i] = r[2 * m - 1 - i];
+        r[2 * m - 1 - i] = t;
+    }
+#pragma GCC unroll 16
+    for (int i = m; i < 2 * m; i++)
+        r[i] = _mm512_permutexvar_epi32(reverse, r[i]);
+
+#pragma GCC unroll 16
+    for (int s = m; s > 0; s /= 2)
+#pragma GCC unroll 16
+        for (int i = 0; i < 2 * m; i += 2 * s)
+#pragma GCC unroll 16
+            for (int j = i; j < i + s; j++)
+            {
+                __m512i lo = _mm512_min_epi32(r[j], r[j + s]);
+                r[j + s] = _mm512_max_epi32(r[j], r[j + s]);
+                r[j] = lo;
+            }
+#pragma GCC unroll 16
+    for (int i = 0; i < 2 * m; i++)
+#pragma GCC unroll 16
+        for (int j = 8; j > 0; j /= 2)
+            r[i] = exchange_avx512(r[i], j, 16);
+}
+
+/**
+ * @brief Sorts buf[0..regs*16-1] in registers, regs is a compile time constant after inlining
+ */
+__attribute__((target("avx512f"), always_inline)) static inline void sort_block_avx512(int32_t *buf, int regs)
+{
+    __m512i r[SIMD_LEAF_MAX / 16];
+
+#pragma GCC unroll 16
+    for (int i = 0; i < regs; i++)
+        r[i] = sort_register_avx512(_mm512_load_si512((const void *) (buf + 16 * i)));
+#pragma GCC unroll 16
+    for (int m = 1; m < regs; m *= 2)
+#pragma GCC unroll 16
+        for (int i = 0; i < regs; i += 2 * m)
+            merge_registers_avx512(r + i, m);
+#pragma GCC unroll 16
+    for (int i = 0; i < regs; i++)
+        _mm512_store_si512((void *) (buf + 16 * i), r[i]);
+}
+
+__attribute__((target("avx512f"))) static void leaf_sort_avx512(int32_t *arr, size_t n)
+{
+    int32_t buf[SIMD_LEAF_MAX] __attribute__((aligned(64)));
+    int regs = simd_registers(n, 16);
+
+    for (int i = 0; i < regs * 16; i++)
+        buf[i] = INT32_MAX;
+    memcpy(buf, arr, n * sizeof(int32_t));
+
+    // One fully unrolled network per block size
+    switch (regs)
+    {
+        case 1:
+            sort_block_avx512(buf, 1);
+            break;
+        case 2:
+            sort_block_avx512(buf, 2);
+            break;
+        case 4:
+            sort_block_avx512(buf, 4);
+            break;
+    }
+
+    memcpy(arr, buf, n * sizeof(int32_t));
+}
+
+#endif // SIMD_X86
+
+#ifdef SIMD_NEON
+
+/************************************************ NEON ************************************************/
+
+static inline int32x4_t exchange_neon(int32x4_t v, int j, int k)
+{
+    static const uint32_t lane_index[4] = {0, 1, 2, 3};
+    const uint32x4_t lane = vld1q_u32(lane_index);
+    const uint32x4_t zero = vdupq_n_u32(0);
+
+    // Lane i ^ 1 swaps neighbours, lane i ^ 2 swaps the two halves
+    int32x4_t partner = j == 1 ? vrev64q_s32(v) : vextq_s32(v, v, 2);
+    int32x4_t lo = vminq_s32(v, partner);
+    int32x4_t hi = vmaxq_s32(v, partner);
+    uint32x4_t take_hi = veorq_u32(vceqq_u32(vandq_u32(lane, vdupq_n_u32((uint32_t) j)), zero),
+                                   vceqq_u32(vandq_u32(lane, vdupq_n_u32((uint32_t) k)), zero));
+    return vbslq_s32(take_hi, hi, lo);
+}
+
+static inline int32x4_t sort_register_neon(int32x4_t v)
+{
+#pragma GCC unroll 16
+    for (int k = 2; k <= 4; k *= 2)
+#pragma GCC unroll 16
+        for (int j = k / 2; j > 0; j /= 2)
+            v = exchange_neon(v, j, k);
+    return v;
+}
+
+static inline void merge_registers_neon(int32x4_t *r, int m)
+{
+#pragma GCC unroll 16
+    for (int i = 0; i < m / 2; i++)
+    {
+        int32x4_t t = r[m + i];
+        r[m + i] = r[2 * m - 1 - i];
+        r[2 * m - 1 - i] = t;
+    }
+#pragma GCC unroll 16
+    for (int i = m; i < 2 * m; i++)
+    {
+        int32x4_t v = vrev64q_s32(r[i]);
+        r[i] = vextq_s32(v, v, 2);
+    }
+
+#pragma GCC unroll 16
+    for (int s = m; s > 0; s /= 2)
+#pragma GCC unroll 16
+        for (int i = 0; i < 2 * m; i += 2 * s)
+#pragma GCC unroll 16
+            for (int j = i; j < i + s; j++)
+            {
+                int32x4_t lo = vminq_s32(r[j], r[j + s]);
+                r[j + s] = vmaxq_s32(r[j], r[j + s]);
+                r[j] = lo;
+            }
+#pragma GCC unroll 16
+    for (int i = 0; i < 2 * m; i++)
+#pragma GCC unroll 16
+        for (int j = 2; j > 0; j /= 2)
+            r[i] = exchange_neon(r[i], j, 4);
+}
+
+__attribute__((always_inline)) static inline void sort_block_neon(int32_t *buf, int regs)
+{
+    int32x4_t r[SIMD_LEAF_MAX / 4];
+
+#pragma GCC unroll 16
+    for (int i = 0; i < regs; i++)
+        r[i] = sort_register_neon(vld1q_s32(buf + 4 * i));
+#pragma GCC unroll 16
+    for (int m = 1; m < regs; m *= 2)
+#pragma GCC unroll 16
+        for (int i = 0; i < regs; i += 2 * m)
+            merge_registers_neon(r + i, m);
+#pragma GCC unroll 16
+    for (int i = 0; i < regs; i++)
+        vst1q_s32(buf + 4 * i, r[i]);
+}
+
+static void leaf_sort_neon(int32_t *arr, size_t n)
+{
+    int32_t buf[SIMD_LEAF_MAX];
+    int regs = simd_registers(n, 4);
+
+    for (int i = 0; i < regs * 4; i++)
+        buf[i] = INT32_MAX;
+    memcpy(buf, arr, n * sizeof(int32_t));
+
+    switch (regs)
+    {
+        case 1:
+            sort_block_neon(buf, 1);
+            break;
+        case 2:
+            sort_block_neon(buf, 2);
+            break;
+        case 4:
+            sort_block_neon(buf, 4);
+            break;
+        case 8:
+            sort_block_neon(buf, 8);
+            break;
+        case 16:
+            sort_block_neon(buf, 16);
+            break;
+    }
+
+    memcpy(arr, buf, n * sizeof(int32_t));
+}
+
+#endif // SIMD_NEON
+
+/**
+ * @brief Picks the widest leaf kernel the CPU supports, capped by MERGE_SORT_SIMD.
+ * @return the kernel, or NULL if none is available (the scalar recursion is used then)
+ */
+static simd_leaf_fn simd_select_leaf(void)
+{
+    const char *cap = getenv("MERGE_SORT_SIMD");
+    int max_level = 3;  // 0 = scalar, 1 = NEON, 2 = AVX2, 3 = AVX-512
+
+    if (cap != NULL)
+    {
+        if (strcmp(cap, "scalar") == 0)
+            max_level = 0;
+        else if (strcmp(cap, "neon") == 0)
+            max_level = 1;
+        else if (strcmp(cap, "avx2") == 0)
+            max_level = 2;
+    }
+
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    if (max_level >= 3 && __builtin_cpu_supports("avx512f"))
+        return leaf_sort_avx512;
+    if (max_level >= 2 && __builtin_cpu_supports("avx2"))
+        return leaf_sort_avx2;
+#endif
+#ifdef SIMD_NEON
+    if (max_level >= 1)
+        return leaf_sort_neon;
+#endif
+    (void) max_level;
+    return NULL;
+}
+
+#endif // PARALLEL_MERGE_SORT_SIMD_H
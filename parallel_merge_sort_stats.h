@@ -0,0 +1,142 @@
+/****************************************************************************************************
+ Statistics of the sorts, compiled in with -DMERGE_SORT_STATS:
+
+ Every thread adds to its own counters (one cache line apart, indexed by omp_get_thread_num()),
+ merge_sort_stats_get() adds them up. The sort measures with omp_get_wtime() where the work is done:
+ the copy into the scratch array, every sequential leaf (the outermost call of merge_sort_recursive()
+ that creates no tasks, with the merges inside it) and every chunk of a parallel merge, by the size of
+ the whole merge, and the two steps of every radix pass. Times are thread-seconds, summed over all
+ threads. The in-place and the natural merges are only part of the time of the sort calls.
+
+ Without MERGE_SORT_STATS, the STATS_*() macros are empty, and the sorts are the same code as
+ without this file.
+ ****************************************************************************************************/
+
+#ifndef PARALLEL_MERGE_SORT_STATS_H
+#define PARALLEL_MERGE_SORT_STATS_H
+
+#include <omp.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "parallel_merge_sort.h"
+
+#ifdef MERGE_SORT_STATS
+
+// Threads with their own counters, higher thread numbers share them (and may lose updates)
+#define STATS_THREADS 256
+
+// Counters of one thread
+struct stats_thread
+{
+    _Alignas(64) struct merge_sort_stats s;
+    int in_leaf;    // inside a leaf already, the nested calls are part of its time
+};
+
+static struct stats_thread stats_threads[STATS_THREADS];
+
+static inline struct merge_sort_stats *stats_mine(void)
+{
+    return &stats_threads[omp_get_thread_num() % STATS_THREADS].s;
+}
+
+/**
+ * @brief Floor of log2(n), for n >= 1, capped at the last merge level
+ */
+static inline int stats_level(size_t n)
+{
+    int l = 0;
+    while (n > 1 && l < MERGE_SORT_STATS_LEVELS - 1)
+    {
+        n >>= 1;
+        l++;
+    }
+    return l;
+}
+
+// Start of a timed piece of work
+#define STATS_START(t) double t = omp_get_wtime()
+
+// count elements were copied since STATS_START(t)
+#define STATS_COPY(t, count)                                                                        \
+    do                                                                                              \
+    {                                                                                               \
+        struct merge_sort_stats *s_ = stats_mine();                                                 \
+        s_->copy_seconds += omp_get_wtime() - (t);                                                  \
+        s_->copy_elements += (count);                                                               \
+    } while (0)
+
+// A chunk of count elements of a merge of n elements was merged since STATS_START(t)
+#define STATS_MERGE(t, n, count)                                                                    \
+    do                                                                                              \
+    {                                                                                               \
+        struct merge_sort_stats *s_ = stats_mine();                                                 \
+        int l_ = stats_level(n);                                                                    \
+        s_->merge_seconds[l_] += omp_get_wtime() - (t);                                             \
+        s_->merge_elements[l_] += (count);                                                          \
+        s_->merge_chunks[l_]++;                                                                     \
+    } while (0)
+
+// Start of a sequential leaf. A leaf inside a leaf is not timed on its own (t stays negative).
+#define STATS_LEAF_START(t)                                                                         \
+    double t = -1.0;                                                                                \
+    do                                                                                              \
+    {                                                                                               \
+        struct stats_thread *st_ = &stats_threads[omp_get_thread_num() % STATS_THREADS];           \
+        if (!st_->in_leaf)                                                                          \
+        {                                                                                           \
+            st_->in_leaf = 1;                                                                       \
+            t = omp_get_wtime();                                                                    \
+        }                                                                                           \
+    } while (0)
+
+// End of the leaf of count elements started with STATS_LEAF_START(t). A leaf creates no tasks, so it
+// ends on the thread it started on.
+#define STATS_LEAF_END(t, count)                                                                    \
+    do                                                                                              \
+    {                                                                                               \
+        if ((t) >= 0.0)                                                                             \
+        {                                                                                           \
+            struct stats_thread *st_ = &stats_threads[omp_get_thread_num() % STATS_THREADS];       \
+            st_->s.leaf_seconds += omp_get_wtime() - (t);                                           \
+            st_->s.leaf_elements += (count);                                                        \
+            st_->s.leaf_calls++;                                                                    \
+            st_->in_leaf = 0;                                                                       \
+        }                                                                                           \
+    } while (0)
+
+// The digits of a radix pass were counted, or the keys moved, since STATS_START(t)
+#define STATS_RADIX_HISTOGRAM(t) (stats_mine()->radix_histogram_seconds += omp_get_wtime() - (t))
+#define STATS_RADIX_SCATTER(t) (stats_mine()->radix_scatter_seconds += omp_get_wtime() - (t))
+
+// A radix pass moved the keys
+#define STATS_RADIX_PASS() (stats_mine()->radix_passes++)
+
+// A task of the sort was created
+#define STATS_TASK() (stats_mine()->tasks++)
+
+// A whole sort call took the time since STATS_START(t)
+#define STATS_SORT(t)                                                                               \
+    do                                                                                              \
+    {                                                                                               \
+        struct merge_sort_stats *s_ = stats_mine();                                                 \
+        s_->sort_seconds += omp_get_wtime() - (t);                                                  \
+        s_->sorts++;                                                                                \
+    } while (0)
+
+#else
+
+#define STATS_START(t) ((void) 0)
+#define STATS_COPY(t, count) ((void) 0)
+#define STATS_MERGE(t, n, count) ((void) 0)
+#define STATS_LEAF_START(t) ((void) 0)
+#define STATS_LEAF_END(t, count) ((void) 0)
+#define STATS_RADIX_HISTOGRAM(t) ((void) 0)
+#define STATS_RADIX_SCATTER(t) ((void) 0)
+#define STATS_RADIX_PASS() ((void) 0)
+#define STATS_TASK() ((void) 0)
+#define STATS_SORT(t) ((void) 0)
+
+#endif // MERGE_SORT_STATS
+
+#endif // PARALLEL_MERGE_SORT_STATS_H
@@ -0,0 +1,594 @@
+#include <errno.h>
+#include <getopt.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parallel_merge_sort.h"
+
+/****************************************************************************************************
+ Benchmark of the sorts in parallel_merge_sort.c. Every combination of array size, input
+ distribution, backend, thread count and cutoff is sorted a number of times, and the minimum and
+ median time are written as CSV or JSON, one record per combination. Build it together with the
+ sort:
+
+ gcc -O2 -fopenmp -DPARALLEL_MERGE_SORT_NO_MAIN sort_benchmark.c parallel_merge_sort.c
+ ****************************************************************************************************/
+
+// The Zipf keys are drawn from this many distinct values, the i-th most frequent with weight 1/i
+#define ZIPF_VALUES 65536
+
+// Number of distinct keys of the few-unique distribution
+#define FEW_UNIQUE_VALUES 16
+
+enum distribution
+{
+    DIST_UNIFORM,
+    DIST_SORTED,
+    DIST_REVERSE,
+    DIST_FEW_UNIQUE,
+    DIST_ZIPF,
+    DIST_ORGAN_PIPE,
+    DIST_COUNT,
+};
+
+static const char *const distribution_names[DIST_COUNT] = {
+    "uniform", "sorted", "reverse", "few-unique", "zipf", "organ-pipe",
+};
+
+enum backend
+{
+    BACKEND_AUTO,       // the default options
+    BACKEND_MERGE,      // merge sort, branchless merges
+    BACKEND_BRANCHY,    // merge sort, if/else merges
+    BACKEND_IN_PLACE,   // merge sort with MERGE_SORT_IN_PLACE
+    BACKEND_KWAY,       // merge sort with 8-way loser tree merges
+    BACKEND_RADIX,
+    BACKEND_SAMPLE,
+    BACKEND_QSORT,      // qsort() of the C library, sequential
+    BACKEND_COUNT,
+};
+
+static const char *const backend_names[BACKEND_COUNT] = {
+    "auto", "merge", "merge-branchy", "merge-in-place", "merge-kway8", "radix", "sample", "qsort",
+};
+
+// The values of one option list, e.g. "1M,10M"
+struct list
+{
+    size_t count;
+    size_t *values;
+};
+
+/**
+ * @brief splitmix64, used as a counter-based generator: the key at index i only depends on i, so
+ * the input is the same for every thread count and every run.
+ */
+static uint64_t mix(uint64_t x)
+{
+    x += UINT64_C(0x9e3779b97f4a7c15);
+    x = (x ^ (x >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+    x = (x ^ (x >> 27)) * UINT64_C(0x94d049bb133111eb);
+    return x ^ (x >> 31);
+}
+
+/**
+ * @brief Fills arr[0..n-1] with keys of the given distribution, in parallel.
+ * @param: zipf_cdf = cumulative weights of the ZIPF_VALUES Zipf ranks, normalised to 1
+ */
+static void generate(int32_t *arr, size_t n, enum distribution dist, const double *zipf_cdf)
+{
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64_t r = mix(i);
+        switch (dist)
+        {
+            case DIST_UNIFORM:
+                arr[i] = (int32_t) (uint32_t) r;
+                break;
+            case DIST_SORTED:
+                arr[i] = (int32_t) i;
+                break;
+            case DIST_REVERSE:
+                arr[i] = (int32_t) (n - 1 - i);
+                break;
+            case DIST_FEW_UNIQUE:
+                arr[i] = (int32_t) (uint32_t) mix(r % FEW_UNIQUE_VALUES);
+                break;
+            case DIST_ZIPF:
+            {
+                // Rank with zipf_cdf[rank - 1] <= u < zipf_cdf[rank], found by binary search
+                double u = (double) (r >> 11) * 0x1p-53;
+                size_t lo = 0, hi = ZIPF_VALUES - 1;
+                while (lo < hi)
+                {
+                    size_t m = lo + (hi - lo) / 2;
+                    if (zipf_cdf[m] <= u)
+                        lo = m + 1;
+                    else
+                        hi = m;
+                }
+                // The frequent keys are spread over the whole range, not the smallest ones
+                arr[i] = (int32_t) (uint32_t) mix(lo);
+                break;
+            }
+            case DIST_ORGAN_PIPE:
+                arr[i] = (int32_t) (i < n / 2 ? i : n - 1 - i);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+static int compare_int32(const void *a, const void *b)
+{
+    int32_t x = *(const int32_t *) a, y = *(const int32_t *) b;
+    return (x > y) - (x < y);
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Sorts arr with the backend.
+ * @param: cutoff = merge_sort_options.cutoff
+ * @return 0 on success, -1 if the sort could not allocate its scratch memory
+ */
+static int run_backend(enum backend backend, int32_t *arr, size_t n, int nthreads, size_t cutoff)
+{
+    struct merge_sort_options opts = {.nthreads = nthreads, .cutoff = cutoff};
+
+    switch (backend)
+    {
+        case BACKEND_MERGE:
+            opts.algorithm = MERGE_SORT_MERGE;
+            break;
+        case BACKEND_BRANCHY:
+            opts.algorithm = MERGE_SORT_MERGE;
+            opts.kernel = MERGE_SORT_BRANCHY;
+            break;
+        case BACKEND_IN_PLACE:
+            opts.memory = MERGE_SORT_IN_PLACE;
+            break;
+        case BACKEND_KWAY:
+            opts.algorithm = MERGE_SORT_MERGE;
+            opts.kway = 8;
+            break;
+        // The forced backends never hand sorted runs to the natural merge, so their rows time them
+        case BACKEND_RADIX:
+            opts.algorithm = MERGE_SORT_RADIX;
+            opts.adaptive = MERGE_SORT_ADAPTIVE_OFF;
+            break;
+        case BACKEND_SAMPLE:
+            opts.algorithm = MERGE_SORT_SAMPLE;
+            opts.adaptive = MERGE_SORT_ADAPTIVE_OFF;
+            break;
+        case BACKEND_QSORT:
+            qsort(arr, n, sizeof(int32_t), compare_int32);
+            return 0;
+        default:
+            break;
+    }
+    return parallel_merge_sort_opts(arr, n, &opts);
+}
+
+/**
+ * @brief Parses a number with an optional K, M or G suffix (powers of 1024).
+ * @return 0 on success, -1 if str is not such a number
+ */
+static int parse_count(const char *str, size_t *count)
+{
+    char *endptr;
+    errno = 0;
+    unsigned long long value = strtoull(str, &endptr, 0);
+    if (errno != 0 || endptr == str || *str == '-')
+        return -1;
+
+    unsigned int shift = 0;
+    if (*endptr == 'k' || *endptr == 'K')
+        shift = 10;
+    else if (*endptr == 'm' || *endptr == 'M')
+        shift = 20;
+    else if (*endptr == 'g' || *endptr == 'G')
+        shift = 30;
+    else if (*endptr != '\0')
+        return -1;
+    if (shift > 0 && endptr[1] != '\0')
+        return -1;
+    if (value > (SIZE_MAX >> shift))
+        return -1;
+    *count = (size_t) value << shift;
+    return 0;
+}
+
+/**
+ * @brief Returns the index of str in names[0..count-1], or -1.
+ */
+static int find_name(const char *str, const char *const names[], int count)
+{
+    for (int i = 0; i < count; i++)
+        if (strcmp(str, names[i]) == 0)
+            return i;
+    return -1;
+}
+
+/**
+ * @brief Parses a comma-separated list into list. Every item is converted by the switch on kind:
+ * 'n' for sizes, 't' for thread counts, 'c' for cutoffs ("default", "auto" or a count), 'd' for
+ * distributions and 'b' for backends.
+ * @return 0 on success, -1 if an item is invalid (it is reported on stderr)
+ */
+static int parse_list(const char *str, int kind, struct list *list)
+{
+    char *copy = strdup(str);
+    if (copy == NULL)
+        return -1;
+
+    size_t capacity = 1;
+    for (const char *c = str; *c != '\0'; c++)
+        capacity += *c == ',';
+    free(list->values);
+    list->values = (size_t *) malloc(capacity * sizeof(size_t));
+    list->count = 0;
+    if (list->values == NULL)
+    {
+        free(copy);
+        return -1;
+    }
+
+    char *save;
+    for (char *item = strtok_r(copy, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save))
+    {
+        size_t value = 0;
+        int ok = 1;
+        int index;
+        switch (kind)
+        {
+            case 'n':
+                ok = parse_count(item, &value) == 0 && value > 0 && value <= SIZE_MAX / sizeof(int32_t);
+                break;
+            case 't':
+                ok = parse_count(item, &value) == 0 && value > 0 && value <= 4096;
+                break;
+            case 'c':
+                if (strcmp(item, "auto") == 0)
+                    value = MERGE_SORT_CUTOFF_AUTO;
+                else if (strcmp(item, "default") != 0)
+                    ok = parse_count(item, &value) == 0 && value > 0;
+                break;
+            case 'd':
+                index = find_name(item, distribution_names, DIST_COUNT);
+                ok = index >= 0;
+                value = (size_t) index;
+                break;
+            case 'b':
+                index = find_name(item, backend_names, BACKEND_COUNT);
+                ok = index >= 0;
+                value = (size_t) index;
+                break;
+            default:
+                ok = 0;
+                break;
+        }
+        if (!ok)
+        {
+            fprintf(stderr, "Error: invalid list item '%s'!\n", item);
+            free(copy);
+            return -1;
+        }
+        list->values[list->count++] = value;
+    }
+
+    free(copy);
+    if (list->count == 0)
+    {
+        fprintf(stderr, "Error: empty list '%s'!\n", str);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Sets list to the values 0..count-1 (all distributions or backends).
+ * @return 0 on success, -1 if the list could not be allocated
+ */
+static int list_all(struct list *list, size_t count)
+{
+    list->values = (size_t *) malloc(count * sizeof(size_t));
+    if (list->values == NULL)
+        return -1;
+    for (size_t i = 0; i < count; i++)
+        list->values[i] = i;
+    list->count = count;
+    return 0;
+}
+
+/**
+ * @brief Prints the usage, to stderr as an error or to stdout for -h
+ */
+static void usage(const char *prog, FILE *out)
+{
+    fprintf(out,
+            "%s: %s [options]\n"
+            "Sorts every combination of the listed values and reports the minimum and median time.\n"
+            "Lists are comma-separated, counts take an optional K, M or G suffix.\n"
+            "  -n, --sizes <list>          array sizes (default 1M)\n"
+            "  -d, --distributions <list>  uniform, sorted, reverse, few-unique, zipf, organ-pipe\n"
+            "                              (default all)\n"
+            "  -b, --backends <list>       auto, merge, merge-branchy, merge-in-place, merge-kway8,\n"
+            "                              radix, sample, qsort (default all)\n"
+            "  -t, --threads <list>        thread counts (default: OMP_NUM_THREADS)\n"
+            "  -c, --cutoffs <list>        sequential cutoffs, default or auto (default: default)\n"
+            "  -r, --repetitions <n>       sorts per combination (default 5)\n"
+            "  -f, --format <fmt>          csv (default) or json\n"
+            "  -o, --output <file>         file to write the results to (default stdout)\n"
+            "  -h, --help                  print this help\n",
+            out == stderr ? "Error: usage" : "Usage", prog);
+}
+
+/**
+ * @brief Writes one result record. qsort and the cutoff "default" are written as cutoff 0, "auto"
+ * as "auto".
+ */
+static void print_record(FILE *out, int json, int first, enum backend backend, enum distribution dist, size_t n,
+                         int nthreads, size_t cutoff, int reps, double min_time, double median_time)
+{
+    char cutoff_str[32];
+    if (cutoff == MERGE_SORT_CUTOFF_AUTO)
+        snprintf(cutoff_str, sizeof(cutoff_str), json ? "\"auto\"" : "auto");
+    else
+        snprintf(cutoff_str, sizeof(cutoff_str), "%zu", cutoff);
+
+    double elements_per_second = median_time > 0.0 ? (double) n / median_time : 0.0;
+    double gb_per_second = elements_per_second * sizeof(int32_t) / 1e9;
+
+    if (json)
+        fprintf(out,
+                "%s  {\"backend\": \"%s\", \"distribution\": \"%s\", \"n\": %zu, \"threads\": %d, "
+                "\"cutoff\": %s, \"repetitions\": %d, \"min_s\": %.6f, \"median_s\": %.6f, "
+                "\"elements_per_s\": %.0f, \"gb_per_s\": %.3f}",
+                first ? "" : ",\n", backend_names[backend], distribution_names[dist], n, nthreads, cutoff_str,
+                reps, min_time, median_time, elements_per_second, gb_per_second);
+    else
+        fprintf(out, "%s,%s,%zu,%d,%s,%d,%.6f,%.6f,%.0f,%.3f\n", backend_names[backend], distribution_names[dist],
+                n, nthreads, cutoff_str, reps, min_time, median_time, elements_per_second, gb_per_second);
+    fflush(out);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        {"sizes", required_argument, NULL, 'n'},
+        {"distributions", required_argument, NULL, 'd'},
+        {"backends", required_argument, NULL, 'b'},
+        {"threads", required_argument, NULL, 't'},
+        {"cutoffs", required_argument, NULL, 'c'},
+        {"repetitions", required_argument, NULL, 'r'},
+        {"format", required_argument, NULL, 'f'},
+        {"output", required_argument, NULL, 'o'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    struct list sizes = {0}, dists = {0}, backends = {0}, threads = {0}, cutoffs = {0};
+    int reps = 5;
+    int json = 0;
+    const char *output = NULL;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "n:d:b:t:c:r:f:o:h", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                if (parse_list(optarg, 'n', &sizes) != 0)
+                    return EXIT_FAILURE;
+                break;
+            case 'd':
+                if (parse_list(optarg, 'd', &dists) != 0)
+                    return EXIT_FAILURE;
+                break;
+            case 'b':
+                if (parse_list(optarg, 'b', &backends) != 0)
+                    return EXIT_FAILURE;
+                break;
+            case 't':
+                if (parse_list(optarg, 't', &threads) != 0)
+                    return EXIT_FAILURE;
+                break;
+            case 'c':
+                if (parse_list(optarg, 'c', &cutoffs) != 0)
+                    return EXIT_FAILURE;
+                break;
+            case 'r':
+                reps = atoi(optarg);
+                if (reps <= 0)
+                {
+                    fprintf(stderr, "Error: invalid number of repetitions '%s'!\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'f':
+                if (strcmp(optarg, "json") == 0)
+                    json = 1;
+                else if (strcmp(optarg, "csv") != 0)
+                {
+                    fprintf(stderr, "Error: unknown format '%s'!\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'h':
+                usage(argv[0], stdout);
+                return EXIT_SUCCESS;
+            default:
+                usage(argv[0], stderr);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind < argc)
+    {
+        usage(argv[0], stderr);
+        return EXIT_FAILURE;
+    }
+
+    if ((sizes.count == 0 && parse_list("1M", 'n', &sizes) != 0) ||
+        (dists.count == 0 && list_all(&dists, DIST_COUNT) != 0) ||
+        (backends.count == 0 && list_all(&backends, BACKEND_COUNT) != 0) ||
+        (cutoffs.count == 0 && parse_list("default", 'c', &cutoffs) != 0))
+    {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    if (threads.count == 0)
+    {
+        threads.values = (size_t *) malloc(sizeof(size_t));
+        if (threads.values == NULL)
+        {
+            perror("malloc");
+            return EXIT_FAILURE;
+        }
+        threads.values[0] = (size_t) omp_get_max_threads();
+        threads.count = 1;
+    }
+
+    FILE *out = stdout;
+    if (output != NULL && (out = fopen(output, "w")) == NULL)
+    {
+        fprintf(stderr, "Error: opening %s failed: %s\n", output, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    int max_threads = 1;
+    for (size_t i = 0; i < threads.count; i++)
+        if ((int) threads.values[i] > max_threads)
+            max_threads = (int) threads.values[i];
+
+    double *zipf_cdf = (double *) malloc(ZIPF_VALUES * sizeof(double));
+    double *times = (double *) malloc((size_t) reps * sizeof(double));
+    if (zipf_cdf == NULL || times == NULL)
+    {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    double total = 0.0;
+    for (size_t i = 0; i < ZIPF_VALUES; i++)
+    {
+        total += 1.0 / (double) (i + 1);
+        zipf_cdf[i] = total;
+    }
+    for (size_t i = 0; i < ZIPF_VALUES; i++)
+        zipf_cdf[i] /= total;
+
+    if (json)
+        fprintf(out, "[\n");
+    else
+        fprintf(out, "backend,distribution,n,threads,cutoff,repetitions,min_s,median_s,elements_per_s,gb_per_s\n");
+    int first = 1;
+
+    for (size_t si = 0; si < sizes.count; si++)
+    {
+        size_t n = sizes.values[si];
+
+        // The input is generated once per size and distribution and copied before every sort
+        int32_t *input = (int32_t *) malloc(n * sizeof(int32_t));
+        int32_t *arr = (int32_t *) merge_sort_alloc_local(n, sizeof(int32_t), max_threads);
+        if (input == NULL || arr == NULL)
+        {
+            fprintf(stderr, "Error: could not allocate two arrays of %zu keys!\n", n);
+            return EXIT_FAILURE;
+        }
+
+        for (size_t di = 0; di < dists.count; di++)
+        {
+            enum distribution dist = (enum distribution) dists.values[di];
+            generate(input, n, dist, zipf_cdf);
+
+            for (size_t bi = 0; bi < backends.count; bi++)
+            {
+                enum backend backend = (enum backend) backends.values[bi];
+
+                // qsort does not depend on the threads and the cutoff, it is measured once
+                size_t nthreads_count = backend == BACKEND_QSORT ? 1 : threads.count;
+                size_t cutoffs_count = backend == BACKEND_QSORT ? 1 : cutoffs.count;
+
+                for (size_t ti = 0; ti < nthreads_count; ti++)
+                {
+                    int nthreads = backend == BACKEND_QSORT ? 1 : (int) threads.values[ti];
+
+                    for (size_t ci = 0; ci < cutoffs_count; ci++)
+                    {
+                        size_t cutoff = backend == BACKEND_QSORT ? 0 : cutoffs.values[ci];
+
+                        // Calibrate before the first timed sort, later calls take the cached value
+                        if (cutoff == MERGE_SORT_CUTOFF_AUTO)
+                            merge_sort_calibrate_cutoff(nthreads);
+
+                        for (int rep = 0; rep < reps; rep++)
+                        {
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+                            for (size_t i = 0; i < n; i++)
+                                arr[i] = input[i];
+
+                            double start = omp_get_wtime();
+                            if (run_backend(backend, arr, n, nthreads, cutoff) != 0)
+                            {
+                                fprintf(stderr, "Error: %s could not allocate memory for %zu keys!\n",
+                                        backend_names[backend], n);
+                                return EXIT_FAILURE;
+                            }
+                            times[rep] = omp_get_wtime() - start;
+
+                            if (rep == 0)
+                            {
+                                int sorted = 1;
+#pragma omp parallel for num_threads(nthreads) schedule(static) reduction(&&:sorted)
+                                for (size_t i = 1; i < n; i++)
+                                    sorted = sorted && arr[i - 1] <= arr[i];
+                                if (!sorted)
+                                {
+                                    fprintf(stderr, "Error: %s did not sort the %s keys!\n", backend_names[backend],
+                                            distribution_names[dist]);
+                                    return EXIT_FAILURE;
+                                }
+                            }
+                        }
+
+                        qsort(times, (size_t) reps, sizeof(double), compare_double);
+                        double median = reps % 2 == 1 ? times[reps / 2]
+                                                      : (times[reps / 2 - 1] + times[reps / 2]) / 2;
+                        print_record(out, json, first, backend, dist, n, nthreads, cutoff, reps, times[0], median);
+                        first = 0;
+                    }
+                }
+            }
+        }
+
+        free(input);
+        free(arr);
+    }
+
+    if (json)
+        fprintf(out, "%s]\n", first ? "" : "\n");
+
+    free(zipf_cdf);
+    free(times);
+    free(sizes.values);
+    free(dists.values);
+    free(backends.values);
+    free(threads.values);
+    free(cutoffs.values);
+    if (out != stdout && fclose(out) != 0)
+    {
+        fprintf(stderr, "Error: writing %s failed: %s\n", output, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}